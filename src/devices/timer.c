@@ -8,9 +8,6 @@
 #include "threads/io.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
-
-/* List of sleeping processes */
-static struct list sleeping_list;
   
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -24,11 +21,63 @@ static struct list sleeping_list;
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Pending alarms are kept in a hierarchical timing wheel.  Level
+   0 has one slot per tick for the next TW0_SIZE ticks.  Each of
+   the TWN_LEVELS higher levels has TWN_SIZE slots, each covering
+   as many ticks as the whole level below it.  Alarms too far in
+   the future for any level wait on tw_overflow.
+
+   An alarm is inserted into the lowest level that can hold it,
+   in constant time.  Whenever level N wraps around, the next
+   slot of level N + 1 is "cascaded", that is, its alarms are
+   redistributed into the lower levels.  Thus, each alarm is
+   touched at most once per level before it expires, and the
+   timer interrupt only looks at the alarms that are due. */
+#define TW0_BITS 8                      /* log2 of level 0 slots. */
+#define TWN_BITS 6                      /* log2 of higher level slots. */
+#define TWN_LEVELS 3                    /* Number of higher levels. */
+#define TW0_SIZE (1 << TW0_BITS)
+#define TWN_SIZE (1 << TWN_BITS)
+static struct list tw0[TW0_SIZE];
+static struct list twn[TWN_LEVELS][TWN_SIZE];
+static struct list tw_overflow;
+static long long wheel_op_cnt;  /* # of alarms cascaded or fired. */
+
+/* 8254 input frequency, and the counter value for one tick,
+   rounded to nearest. */
+#define PIT_HZ 1193180
+#define TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Tickless idle.  If true, set by kernel command-line option
+   "-tickless", then when the idle thread halts the CPU, the PIT
+   is switched to one-shot mode to interrupt only at the next tick
+   at which something is due, instead of at every tick.  The
+   16-bit counter limits this to ONESHOT_MAX_TICKS ticks at once.
+   Only the idle thread does this, because when any other thread
+   runs, it needs every tick for its time slice anyway. */
+bool timer_tickless;
+#define ONESHOT_MAX_TICKS (1 + (0xffff - TICK_COUNT) / TICK_COUNT)
+static int64_t oneshot_ticks;   /* Ticks covered by one-shot, or 0. */
+static unsigned oneshot_first;  /* PIT counts until the first tick. */
+static unsigned oneshot_count;  /* Total PIT counts programmed. */
+static int64_t late_ticks;      /* Elapsed ticks not yet accounted. */
+static long long avoided_cnt;   /* # of timer interrupts skipped. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static void wheel_insert (struct timer_alarm *);
+static void wheel_cascade (struct list *);
+static void wheel_advance (void);
+static void timer_advance (void);
+static void timer_skip (void);
+static void pit_periodic (void);
+static void pit_oneshot (unsigned count);
+static unsigned pit_read_count (void);
+static bool tick_pending (void);
+static timer_alarm_func wake_sleeper;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -39,15 +88,16 @@ static void real_time_sleep (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
-  list_init(&sleeping_list);
-  /* 8254 input frequency divided by TIMER_FREQ, rounded to
-     nearest. */
-  uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+  int i, j;
 
-  outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
-  outb (0x40, count & 0xff);
-  outb (0x40, count >> 8);
+  for (i = 0; i < TW0_SIZE; i++)
+    list_init (&tw0[i]);
+  for (i = 0; i < TWN_LEVELS; i++)
+    for (j = 0; j < TWN_SIZE; j++)
+      list_init (&twn[i][j]);
+  list_init (&tw_overflow);
 
+  pit_periodic ();
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -97,32 +147,86 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
-/* The function returns true if a sleeping thread A has smaller wakeup_time than another sleeping thread B
- * It returns false, otherwise. */
-static bool
-wakeup_time_less (const struct list_elem *a_, const struct list_elem *b_,
-            void *aux UNUSED) 
-{
-  const struct thread *a = list_entry (a_, struct thread, sleeping_elem);
-  const struct thread *b = list_entry (b_, struct thread, sleeping_elem);
-  
-  return a->wakeup_time < b->wakeup_time;
-}
-
 /* Suspends execution for approximately TICKS timer ticks. */
 void
 timer_sleep (int64_t ticks) 
 {
   int64_t start = timer_ticks ();
+  struct timer_alarm alarm;
+  struct semaphore sema;
 
   ASSERT (intr_get_level () == INTR_ON);
-  struct thread * t = thread_current();
-  t->wakeup_time = start + ticks;
-  sema_init(&t->sleeping_sema, 0);
-  intr_disable();
-  list_insert_ordered(&sleeping_list, &t->sleeping_elem, wakeup_time_less , NULL);
-  intr_enable();
-  sema_down(&t->sleeping_sema);
+  if (ticks <= 0)
+    return;
+
+  sema_init (&sema, 0);
+  timer_alarm_init (&alarm, wake_sleeper, &sema);
+  if (timer_alarm_set (&alarm, start + ticks))
+    sema_down (&sema);
+}
+
+/* Alarm function used by timer_sleep(). */
+static void
+wake_sleeper (struct timer_alarm *alarm) 
+{
+  sema_up (alarm->aux);
+}
+
+/* Initializes ALARM to call FUNC, passing ALARM itself, when it
+   expires.  AUX is for FUNC's use.  The alarm is not armed. */
+void
+timer_alarm_init (struct timer_alarm *alarm, timer_alarm_func *func,
+                  void *aux) 
+{
+  ASSERT (alarm != NULL);
+  ASSERT (func != NULL);
+
+  alarm->armed = false;
+  alarm->func = func;
+  alarm->aux = aux;
+}
+
+/* Arms ALARM, which must not already be armed, to fire at timer
+   tick WAKEUP_TIME.  Its function will be called from the timer
+   interrupt handler, so it must not sleep.  Returns true if
+   successful, false without arming ALARM if WAKEUP_TIME has
+   already passed. */
+bool
+timer_alarm_set (struct timer_alarm *alarm, int64_t wakeup_time) 
+{
+  enum intr_level old_level;
+  bool success = false;
+
+  ASSERT (alarm != NULL);
+  ASSERT (!alarm->armed);
+
+  old_level = intr_disable ();
+  if (wakeup_time > ticks)
+    {
+      alarm->wakeup_time = wakeup_time;
+      alarm->armed = true;
+      wheel_insert (alarm);
+      success = true;
+    }
+  intr_set_level (old_level);
+  return success;
+}
+
+/* Disarms ALARM if it has not fired yet. */
+void
+timer_alarm_cancel (struct timer_alarm *alarm) 
+{
+  enum intr_level old_level;
+
+  ASSERT (alarm != NULL);
+
+  old_level = intr_disable ();
+  if (alarm->armed)
+    {
+      list_remove (&alarm->elem);
+      alarm->armed = false;
+    }
+  intr_set_level (old_level);
 }
 
 /* Suspends execution for approximately MS milliseconds. */
@@ -146,31 +250,284 @@ timer_nsleep (int64_t ns)
   real_time_sleep (ns, 1000 * 1000 * 1000);
 }
 
+/* Returns the number of times the timing wheel has moved an
+   alarm down a level or fired one, a measure of the work the
+   timer interrupt has done on alarms. */
+long long
+timer_wheel_ops (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  long long cnt = wheel_op_cnt;
+  intr_set_level (old_level);
+  return cnt;
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) 
 {
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  if (timer_tickless)
+    printf ("Timer: %lld interrupts avoided by tickless idle\n", avoided_cnt);
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  In tickless mode, reprograms the PIT to skip
+   the ticks at which nothing is due, up to the next tick at
+   which an alarm fires or the timing wheel cascades. */
+void
+timer_idle_enter (void) 
+{
+  int64_t n;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || oneshot_ticks != 0)
+    return;
+
+  for (n = 1; n < ONESHOT_MAX_TICKS; n++) 
+    {
+      int64_t t = ticks + n;
+      if ((t & (TW0_SIZE - 1)) == 0 || !list_empty (&tw0[t & (TW0_SIZE - 1)]))
+        break;
+    }
+  if (n <= 1)
+    return;
+
+  /* Keep the tick phase: the first tick comes when the current
+     periodic count runs out, the rest at TICK_COUNT intervals.
+     If a periodic tick is already pending, the count has been
+     reloaded and timer_interrupt() would take that tick for the
+     end of the one-shot, so stay periodic this time. */
+  oneshot_first = pit_read_count ();
+  if (tick_pending ())
+    return;
+  oneshot_count = oneshot_first + (n - 1) * TICK_COUNT;
+  oneshot_ticks = n;
+  pit_oneshot (oneshot_count);
+
+  /* A tick that came due while the PIT was being reprogrammed is
+     likewise a periodic one.  Go back to periodic mode, which
+     restarts the count just after the tick boundary. */
+  if (tick_pending ())
+    {
+      oneshot_ticks = 0;
+      pit_periodic ();
+    }
+}
+
+/* Called by the idle thread, with interrupts off, after it wakes
+   up.  If an interrupt other than the timer's woke the CPU before
+   the one-shot period ran out, accounts for the ticks that have
+   elapsed so far and arranges for the timer to interrupt at the
+   next tick boundary, where periodic mode resumes.  Runs in
+   thread context, so it must not call thread_tick(). */
+void
+timer_idle_exit (void) 
+{
+  unsigned elapsed, k;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_ticks == 0)
+    return;
+
+  /* Read back the status of counter 0.  If OUT is high, the
+     one-shot has run out and its interrupt is pending, so leave
+     it to the interrupt handler. */
+  outb (0x43, 0xe2);
+  if (inb (0x40) & 0x80)
+    return;
+
+  elapsed = oneshot_count - pit_read_count ();
+  k = elapsed < oneshot_first ? 0 : 1 + (elapsed - oneshot_first) / TICK_COUNT;
+  ASSERT (k < oneshot_ticks);
+
+  oneshot_first = oneshot_count = oneshot_first + k * TICK_COUNT - elapsed;
+  oneshot_ticks = 1;
+  pit_oneshot (oneshot_count);
+
+  /* Account for the elapsed ticks now, so that timer_ticks() is
+     right for whatever thread the interrupt woke.  Alarms fire
+     only from the timer interrupt, so if one has been set for a
+     skipped tick since the PIT was programmed, leave that tick
+     and the ones after it for timer_interrupt() to catch up on. */
+  late_ticks += k;
+  while (late_ticks > 0
+         && list_empty (&tw0[(ticks + 1) & (TW0_SIZE - 1)]))
+    {
+      timer_skip ();
+      avoided_cnt++;
+      late_ticks--;
+    }
 }
 
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  enum intr_level old_level = intr_disable();
+  if (oneshot_ticks != 0)
+    {
+      /* A one-shot ran out on a tick boundary.  Catch up on the
+         ticks it skipped and resume periodic mode. */
+      int64_t n = oneshot_ticks + late_ticks;
+
+      oneshot_ticks = late_ticks = 0;
+      pit_periodic ();
+      avoided_cnt += n - 1;
+      while (n-- > 1)
+        timer_advance ();
+    }
+  timer_advance ();
+}
+
+/* Accounts for one timer tick. */
+static void
+timer_advance (void) 
+{
+  ticks++;
+  wheel_advance ();
+  thread_tick ();
+}
+
+/* Accounts for one tick that tickless idle skipped, from the
+   idle thread rather than the timer interrupt.  Only the
+   interrupt may preempt, so this leaves thread_tick() out.  The
+   caller makes sure that no alarm is due and no slot cascades at
+   this tick. */
+static void
+timer_skip (void) 
+{
   ticks++;
-  struct list_elem *e;
-  for (e = list_begin (&sleeping_list); e != list_end (&sleeping_list); e = list_next (e)) {
-    struct thread *t = list_entry (e, struct thread, sleeping_elem);
-    if (t->wakeup_time <=  ticks) {
-      sema_up(&t->sleeping_sema); 
-      list_remove(&t->sleeping_elem);
+  thread_idle_tick ();
+}
+
+/* Sets up the PIT to interrupt TIMER_FREQ times per second. */
+static void
+pit_periodic (void) 
+{
+  outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
+  outb (0x40, TICK_COUNT & 0xff);
+  outb (0x40, TICK_COUNT >> 8);
+}
+
+/* Sets up the PIT to interrupt once, COUNT input clocks from
+   now. */
+static void
+pit_oneshot (unsigned count) 
+{
+  ASSERT (count > 0 && count <= 0xffff);
+
+  outb (0x43, 0x30);    /* CW: counter 0, LSB then MSB, mode 0, binary. */
+  outb (0x40, count & 0xff);
+  outb (0x40, count >> 8);
+}
+
+/* Returns the current value of the PIT's counter 0. */
+static unsigned
+pit_read_count (void) 
+{
+  unsigned lo, hi;
+
+  outb (0x43, 0x00);    /* CW: latch counter 0. */
+  lo = inb (0x40);
+  hi = inb (0x40);
+  return (hi << 8) | lo;
+}
+
+/* Returns true if the timer has raised an interrupt that has not
+   yet been delivered, that is, if IRQ 0 is set in the master
+   PIC's interrupt request register.  Interrupts must be off. */
+static bool
+tick_pending (void) 
+{
+  outb (0x20, 0x0a);    /* OCW3: read the IRR on the next read. */
+  return (inb (0x20) & 0x01) != 0;
+}
+
+/* Adds ALARM to the timing wheel slot that will come due no
+   later than its wakeup time and no earlier than the start of
+   the tick it belongs to.  Interrupts must be off. */
+static void
+wheel_insert (struct timer_alarm *alarm) 
+{
+  int64_t when = alarm->wakeup_time;
+  int64_t delta = when - ticks;
+  struct list *slot;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (delta >= 0);
+
+  if (delta < TW0_SIZE)
+    slot = &tw0[when & (TW0_SIZE - 1)];
+  else
+    {
+      slot = &tw_overflow;
+      for (level = 0; level < TWN_LEVELS; level++) 
+        {
+          int shift = TW0_BITS + level * TWN_BITS;
+          if (delta < (int64_t) 1 << (shift + TWN_BITS))
+            {
+              slot = &twn[level][(when >> shift) & (TWN_SIZE - 1)];
+              break;
+            }
+        }
+    }
+  list_push_back (slot, &alarm->elem);
+}
+
+/* Moves every alarm in SLOT down into the level that now fits
+   it.  Interrupts must be off. */
+static void
+wheel_cascade (struct list *slot) 
+{
+  struct list pending;
+
+  list_init (&pending);
+  while (!list_empty (slot))
+    list_push_back (&pending, list_pop_front (slot));
+  while (!list_empty (&pending))
+    {
+      wheel_insert (list_entry (list_pop_front (&pending),
+                                struct timer_alarm, elem));
+      wheel_op_cnt++;
+    }
+}
+
+/* Cascades any higher-level slots that have come due at the
+   current tick, then fires all the alarms in the current level 0
+   slot.  Called from the timer interrupt handler. */
+static void
+wheel_advance (void) 
+{
+  struct list *slot = &tw0[ticks & (TW0_SIZE - 1)];
+
+  if ((ticks & (TW0_SIZE - 1)) == 0)
+    {
+      int level;
+
+      for (level = 0; level < TWN_LEVELS; level++) 
+        {
+          int shift = TW0_BITS + level * TWN_BITS;
+          int idx = (ticks >> shift) & (TWN_SIZE - 1);
+          wheel_cascade (&twn[level][idx]);
+          if (idx != 0)
+            break;
+        }
+      if (level == TWN_LEVELS)
+        wheel_cascade (&tw_overflow);
+    }
+
+  while (!list_empty (slot)) 
+    {
+      struct timer_alarm *alarm = list_entry (list_pop_front (slot),
+                                              struct timer_alarm, elem);
+      ASSERT (alarm->wakeup_time == ticks);
+      alarm->armed = false;
+      wheel_op_cnt++;
+      alarm->func (alarm);
     }
-    else
-      break; 
-  }
-  thread_tick();
-  intr_set_level(old_level);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
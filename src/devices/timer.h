@@ -1,12 +1,17 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* If true, stop the periodic tick while idle. */
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
 
@@ -18,6 +23,28 @@ void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
 
+/* A one-shot alarm that calls a function from the timer
+   interrupt handler at a given timer tick. */
+struct timer_alarm;
+typedef void timer_alarm_func (struct timer_alarm *);
+struct timer_alarm
+  {
+    int64_t wakeup_time;        /* Tick at which the alarm fires. */
+    bool armed;                 /* Waiting to fire? */
+    struct list_elem elem;      /* Timing wheel element. */
+    timer_alarm_func *func;     /* Function to call. */
+    void *aux;                  /* Auxiliary data for FUNC. */
+  };
+
+void timer_alarm_init (struct timer_alarm *, timer_alarm_func *, void *aux);
+bool timer_alarm_set (struct timer_alarm *, int64_t wakeup_time);
+void timer_alarm_cancel (struct timer_alarm *);
+
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+long long timer_wheel_ops (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
@@ -1,114 +1,669 @@
 #include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "devices/timer.h"
 
-static struct lock cache_lock;
-static struct list sectors_list;
-static int count;
+/* Capacity of the buffer cache in sectors. */
+size_t buffer_cache_size = BUFFER_CACHE_DEFAULT_SIZE;
 
-struct cached_sector * load_sector(disk_sector_t);
-static void flush_periodically();
-void flush();
+/* Slot array.  CLOCK_LOCK only serializes movement of the clock
+   hand; it is never held across disk I/O. */
+static struct cached_sector *slots;
+static size_t clock_hand;
+static struct lock clock_lock;
 
-void buffer_cache_init() {
-  list_init(&sectors_list);
-  lock_init(&cache_lock);
-  count = 0;
-  thread_create("flush_periodically", PRI_DEFAULT, flush_periodically, NULL);
+/* A chain of the hash index, with its own lock and statistics.
+   Lock order is bucket lock, then slot lock. */
+struct cache_bucket {
+  struct lock lock;
+  struct list sectors;
+  long long hit_cnt, miss_cnt, evict_cnt;
+  long long ra_cnt, ra_hit_cnt;
+};
+
+/* Hash index from sector number to slot.  BUCKET_CNT is a power
+   of two no smaller than the cache capacity, so chains stay
+   short. */
+static struct cache_bucket *buckets;
+static size_t bucket_cnt;
+
+/* Read-ahead requests waiting for the read-ahead thread.  The
+   queue is a ring; requests that do not fit are dropped, since
+   read-ahead is only a hint. */
+#define READ_AHEAD_QUEUE_SIZE 64
+static disk_sector_t ra_queue[READ_AHEAD_QUEUE_SIZE];
+static size_t ra_queue_head, ra_queue_cnt;
+static struct lock ra_lock;
+static struct condition ra_nonempty;
+
+/* Write-behind.  Dirty slots sit on DIRTY_LIST, oldest first.
+   Every WRITE_BEHIND_INTERVAL ticks the write-behind thread writes
+   back up to WRITE_BEHIND_BATCH of them, in sector order to cut
+   seeks.  It is woken early, and keeps going without sleeping,
+   while more than half the cache is dirty or a dirty slot had to
+   be evicted. */
+#define WRITE_BEHIND_INTERVAL 10
+#define WRITE_BEHIND_BATCH 16
+static struct list dirty_list;
+static size_t dirty_cnt;
+static struct lock dirty_lock;
+static struct semaphore write_behind_sema;
+
+/* Stamps modifications, under DIRTY_LOCK.  Each dirty slot
+   records the stamps of its first and last modifications since
+   it was last written back.  Slots join DIRTY_LIST in order of
+   their first stamps. */
+static uint64_t dirty_seq;
+
+/* DIRTY_SEQ as of the start of the last completed run of the
+   write-back hook, under DIRTY_LOCK. */
+static uint64_t synced_seq;
+
+/* Called before dirty sectors are written back, so that another
+   module can bring sectors whose on-disk copies must be written
+   first up to date on disk (see free_map_sync()).  It does its
+   own locking, and returns false if it could not run because the
+   caller is already inside it.  A dirty sector may be written
+   back only if it was last modified before a successful run of
+   the hook started, with one exception: see pick_victim().
+   HOOK_LOCK guards WRITE_BACK_HOOK. */
+static bool (*write_back_hook) (void);
+static struct lock hook_lock;
+
+/* A dirty slot picked for write-back, and the sector it held. */
+struct write_back
+  {
+    struct cached_sector *slot;
+    disk_sector_t sector_idx;
+  };
+
+/* Ways to ask get_sector() for a sector. */
+enum sector_access
+  {
+    ACCESS_SHARED,              /* Read the data. */
+    ACCESS_EXCLUSIVE,           /* Modify part of the data. */
+    ACCESS_OVERWRITE,           /* Replace all of the data. */
+    ACCESS_READ_AHEAD           /* Only bring it into the cache. */
+  };
+
+static struct cached_sector * get_sector(disk_sector_t, enum sector_access);
+static void put_sector(struct cached_sector *);
+static struct cached_sector * pick_victim(void);
+static void evict(struct cached_sector *);
+static void mark_dirty(struct cached_sector *);
+static void mark_clean(struct cached_sector *);
+static size_t write_behind(size_t max_cnt);
+static bool write_back(struct cached_sector *, disk_sector_t, uint64_t);
+static bool run_write_back_hook(uint64_t *synced);
+static void write_behind_daemon(void *aux UNUSED);
+static timer_alarm_func wake_write_behind;
+static void read_ahead_daemon(void *aux UNUSED);
+
+static struct cache_bucket * bucket_of(disk_sector_t sector_idx) {
+  return &buckets[hash_int (sector_idx) & (bucket_cnt - 1)];
+}
+
+void buffer_cache_init(void) {
+  size_t i;
+  uint8_t *data;
+
+  if (buffer_cache_size < 1)
+    buffer_cache_size = 1;
+  lock_init(&clock_lock);
+
+  slots = malloc(buffer_cache_size * sizeof *slots);
+  data = palloc_get_multiple(PAL_ASSERT,
+                             DIV_ROUND_UP(buffer_cache_size * DISK_SECTOR_SIZE,
+                                          PGSIZE));
+  if (slots == NULL)
+    PANIC("buffer cache: out of memory");
+  for (i = 0; i < buffer_cache_size; i++) {
+    struct cached_sector *s = &slots[i];
+    s->data = data + i * DISK_SECTOR_SIZE;
+    s->in_use = s->dirty = s->accessed = s->prefetched = false;
+    lock_init(&s->lock);
+    cond_init(&s->cond);
+    s->readers = 0;
+    s->exclusive = false;
+  }
+  clock_hand = 0;
+
+  for (bucket_cnt = 1; bucket_cnt < buffer_cache_size; bucket_cnt *= 2)
+    continue;
+  buckets = malloc(bucket_cnt * sizeof *buckets);
+  if (buckets == NULL)
+    PANIC("buffer cache: out of memory");
+  for (i = 0; i < bucket_cnt; i++) {
+    lock_init(&buckets[i].lock);
+    list_init(&buckets[i].sectors);
+    buckets[i].hit_cnt = buckets[i].miss_cnt = buckets[i].evict_cnt = 0;
+    buckets[i].ra_cnt = buckets[i].ra_hit_cnt = 0;
+  }
+
+  lock_init(&ra_lock);
+  cond_init(&ra_nonempty);
+  ra_queue_head = ra_queue_cnt = 0;
+
+  list_init(&dirty_list);
+  dirty_cnt = 0;
+  lock_init(&dirty_lock);
+  sema_init(&write_behind_sema, 0);
+  lock_init(&hook_lock);
+
+  thread_create("write_behind", PRI_DEFAULT, write_behind_daemon, NULL);
+  thread_create("read_ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Queues SECTOR_IDX to be brought into the cache in the
+   background, if there is room in the queue. */
+void read_ahead_sector(disk_sector_t sector_idx) {
+  lock_acquire(&ra_lock);
+  if (ra_queue_cnt < READ_AHEAD_QUEUE_SIZE) {
+    ra_queue[(ra_queue_head + ra_queue_cnt++) % READ_AHEAD_QUEUE_SIZE] = sector_idx;
+    cond_signal(&ra_nonempty, &ra_lock);
+  }
+  lock_release(&ra_lock);
 }
 
-static void flush_periodically(){
+/* Services the read-ahead queue. */
+static void read_ahead_daemon(void *aux UNUSED) {
   while(true) {
-    timer_sleep(10);
-    flush();
+    disk_sector_t sector_idx;
+    struct cached_sector *s;
+
+    lock_acquire(&ra_lock);
+    while (ra_queue_cnt == 0)
+      cond_wait(&ra_nonempty, &ra_lock);
+    sector_idx = ra_queue[ra_queue_head];
+    ra_queue_head = (ra_queue_head + 1) % READ_AHEAD_QUEUE_SIZE;
+    ra_queue_cnt--;
+    lock_release(&ra_lock);
+
+    s = get_sector(sector_idx, ACCESS_READ_AHEAD);
+    if (s != NULL)
+      put_sector(s);
   }
 }
 
-void flush() {
-  lock_acquire(&cache_lock);
+/* Alarm function that wakes the write-behind thread. */
+static void wake_write_behind(struct timer_alarm *alarm UNUSED) {
+  sema_up(&write_behind_sema);
+}
+
+/* Writes back dirty sectors a batch at a time, sleeping
+   WRITE_BEHIND_INTERVAL ticks between batches unless the cache is
+   under pressure. */
+static void write_behind_daemon(void *aux UNUSED) {
+  struct timer_alarm alarm;
+
+  timer_alarm_init(&alarm, wake_write_behind, NULL);
+  while(true) {
+    if (timer_alarm_set(&alarm, timer_ticks() + WRITE_BEHIND_INTERVAL))
+      sema_down(&write_behind_sema);
+    timer_alarm_cancel(&alarm);
+
+    while (write_behind(WRITE_BEHIND_BATCH) > 0
+           && dirty_cnt > buffer_cache_size / 2)
+      continue;
+  }
+}
+
+/* Orders write_back entries by sector number. */
+static int compare_write_back(const void *a_, const void *b_) {
+  const struct write_back *a = a_;
+  const struct write_back *b = b_;
+  return a->sector_idx < b->sector_idx ? -1 : a->sector_idx > b->sector_idx;
+}
+
+/* Writes back up to MAX_CNT of the oldest dirty sectors, in
+   sector order, and returns the number written.  The batch is
+   chosen before the write-back hook runs, so that the hook
+   covers every sector in it; any sector modified again since is
+   left for later.  Each sector is held shared while it is
+   written, so only writers of that sector wait. */
+static size_t write_behind(size_t max_cnt) {
+  struct write_back batch[WRITE_BEHIND_BATCH];
   struct list_elem *e;
-  for (e = list_begin(&sectors_list); e != list_end (&sectors_list); e = list_next (e)) {
-    struct cached_sector * tmp = list_entry(e, struct cached_sector, elem);
-    sema_down(&tmp->sema);
-    if (tmp->dirty) {
-      disk_write(filesys_disk, tmp->sector_idx, tmp->data);
-      tmp->dirty = false;
-    }
-    sema_up(&tmp->sema);
+  size_t cnt, written, i;
+  uint64_t synced;
+
+  if (max_cnt > WRITE_BEHIND_BATCH)
+    max_cnt = WRITE_BEHIND_BATCH;
+  cnt = 0;
+  lock_acquire(&dirty_lock);
+  for (e = list_begin(&dirty_list); e != list_end(&dirty_list) && cnt < max_cnt;
+       e = list_next(e)) {
+    struct cached_sector *s = list_entry(e, struct cached_sector, dirty_elem);
+    batch[cnt].slot = s;
+    batch[cnt].sector_idx = s->sector_idx;
+    cnt++;
   }
-  lock_release(&cache_lock);
+  lock_release(&dirty_lock);
+  if (cnt == 0)
+    return 0;
+  run_write_back_hook(&synced);
+  qsort(batch, cnt, sizeof *batch, compare_write_back);
+
+  written = 0;
+  for (i = 0; i < cnt; i++)
+    if (write_back(batch[i].slot, batch[i].sector_idx, synced))
+      written++;
+  return written;
 }
 
-struct cached_sector * get_sector(disk_sector_t sector_idx) {
-  lock_acquire(&cache_lock);
-  struct cached_sector * rs = NULL;
+/* Writes slot S back to disk if it still holds SECTOR_IDX and is
+   dirty, last modified no later than stamp SYNCED, and returns
+   true if it did.  The slot may have been cleaned, modified
+   again, or evicted and reused, since the caller looked. */
+static bool write_back(struct cached_sector *s, disk_sector_t sector_idx,
+                       uint64_t synced) {
+  lock_acquire(&s->lock);
+  while (s->in_use && s->sector_idx == sector_idx && s->exclusive)
+    cond_wait(&s->cond, &s->lock);
+  if (!s->in_use || s->sector_idx != sector_idx || !s->dirty
+      || s->dirty_seq > synced) {
+    lock_release(&s->lock);
+    return false;
+  }
+  s->readers++;
+  lock_release(&s->lock);
+
+  disk_write(filesys_disk, sector_idx, s->data);
+  mark_clean(s);
+  put_sector(s);
+  return true;
+}
+
+/* Writes SECTOR_IDX back to disk now if it is cached and dirty,
+   without regard to the write-back hook. */
+void flush_sector(disk_sector_t sector_idx) {
+  struct cache_bucket *b = bucket_of(sector_idx);
+  struct cached_sector *s = NULL;
   struct list_elem *e;
-  for (e = list_begin(&sectors_list); e != list_end (&sectors_list); e = list_next (e)) {
+
+  lock_acquire(&b->lock);
+  for (e = list_begin(&b->sectors); e != list_end (&b->sectors);
+       e = list_next (e)) {
     struct cached_sector * tmp = list_entry(e, struct cached_sector, elem);
     if (tmp->sector_idx == sector_idx) {
-      rs = tmp;
-      sema_down(&rs->sema);
+      s = tmp;
       break;
     }
   }
-  if (rs == NULL)
-    rs = load_sector(sector_idx);
-  lock_release(&cache_lock);
-  return rs;
+  lock_release(&b->lock);
+  if (s != NULL)
+    write_back(s, sector_idx, UINT64_MAX);
 }
 
-struct cached_sector * load_sector(disk_sector_t sector_idx) {
-  struct cached_sector * rs = NULL;
-  if (count < 64) {
-    rs = malloc(sizeof (struct cached_sector));
+/* Sets the function to call before writing back dirty sectors,
+   or none if HOOK is null. */
+void buffer_cache_set_write_back_hook(bool (*hook) (void)) {
+  lock_acquire(&hook_lock);
+  write_back_hook = hook;
+  lock_release(&hook_lock);
+}
+
+/* Runs the write-back hook, if any, waiting for any other thread
+   running it to finish first, and stores in *SYNCED the stamp up
+   to which dirty sectors may now be written back: every stamp if
+   there is no hook.  Returns false if the hook could not run
+   because the caller is already inside it, in which case *SYNCED
+   is as of the hook's last completed run. */
+static bool run_write_back_hook(uint64_t *synced) {
+  bool (*hook) (void);
+  uint64_t seq;
+  bool ran;
+
+  lock_acquire(&hook_lock);
+  hook = write_back_hook;
+  lock_release(&hook_lock);
+  if (hook == NULL) {
+    *synced = UINT64_MAX;
+    return true;
+  }
+
+  lock_acquire(&dirty_lock);
+  seq = dirty_seq;
+  lock_release(&dirty_lock);
+  ran = hook();
+
+  lock_acquire(&dirty_lock);
+  if (ran && seq > synced_seq)
+    synced_seq = seq;
+  *synced = synced_seq;
+  lock_release(&dirty_lock);
+  return ran;
+}
+
+/* Notes that S, held exclusively, has been modified. */
+static void mark_dirty(struct cached_sector *s) {
+  bool pressure;
+
+  lock_acquire(&dirty_lock);
+  if (!s->dirty) {
+    s->dirty = true;
+    list_push_back(&dirty_list, &s->dirty_elem);
+    dirty_cnt++;
+    s->dirty_since = dirty_seq + 1;
+  }
+  s->dirty_seq = ++dirty_seq;
+  pressure = dirty_cnt > buffer_cache_size / 2;
+  lock_release(&dirty_lock);
+  if (pressure)
+    sema_up(&write_behind_sema);
+}
+
+/* Notes that S, which may not be modified meanwhile, has been
+   written back. */
+static void mark_clean(struct cached_sector *s) {
+  lock_acquire(&dirty_lock);
+  if (s->dirty) {
+    s->dirty = false;
+    list_remove(&s->dirty_elem);
+    dirty_cnt--;
+  }
+  lock_release(&dirty_lock);
+}
+
+/* Returns the stamp of the latest modification to any cached
+   sector. */
+uint64_t buffer_cache_stamp(void) {
+  uint64_t seq;
+
+  lock_acquire(&dirty_lock);
+  seq = dirty_seq;
+  lock_release(&dirty_lock);
+  return seq;
+}
+
+/* Returns the stamp up to which every modification has been
+   written back to disk. */
+uint64_t buffer_cache_written_stamp(void) {
+  uint64_t seq;
+
+  lock_acquire(&dirty_lock);
+  if (list_empty(&dirty_list))
+    seq = dirty_seq;
+  else
+    seq = list_entry(list_front(&dirty_list), struct cached_sector,
+                     dirty_elem)->dirty_since - 1;
+  lock_release(&dirty_lock);
+  return seq;
+}
+
+/* Writes every dirty sector back to disk, for sync and at
+   shutdown.  Other threads may keep using the cache meanwhile;
+   returns once every modification made before the call is on
+   disk.  A batch may write nothing, when its sectors were
+   modified again after the write-back hook ran, so keep going
+   until the oldest dirty sector is newer than the call. */
+void flush(void) {
+  uint64_t seq = buffer_cache_stamp();
+
+  while (buffer_cache_written_stamp() < seq)
+    if (write_behind(WRITE_BEHIND_BATCH) == 0)
+      thread_yield();
+}
+
+void buffer_cache_print_stats(void) {
+  long long hit_cnt = 0, miss_cnt = 0, evict_cnt = 0;
+  long long ra_cnt = 0, ra_hit_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < bucket_cnt; i++) {
+    hit_cnt += buckets[i].hit_cnt;
+    miss_cnt += buckets[i].miss_cnt;
+    evict_cnt += buckets[i].evict_cnt;
+    ra_cnt += buckets[i].ra_cnt;
+    ra_hit_cnt += buckets[i].ra_hit_cnt;
+  }
+  printf("Cache: %lld hits, %lld misses, %lld evictions\n",
+         hit_cnt, miss_cnt, evict_cnt);
+  printf("Cache: %lld sectors read ahead, %lld read-ahead hits\n",
+         ra_cnt, ra_hit_cnt);
+}
+
+/* Returns the slot holding SECTOR_IDX, reading it in if
+   necessary, with access to its data held as ACCESS asks.
+   Release with put_sector().
+
+   ACCESS_OVERWRITE is exclusive access for a caller that will
+   replace every byte, so a miss skips the disk read.
+   ACCESS_READ_AHEAD only brings the sector into the cache: it
+   returns a null pointer without waiting if the sector is
+   already there, and otherwise counts the read as read-ahead
+   rather than as a miss. */
+static struct cached_sector * get_sector(disk_sector_t sector_idx,
+                                         enum sector_access access) {
+  struct cache_bucket *b = bucket_of(sector_idx);
+  bool read_ahead = access == ACCESS_READ_AHEAD;
+  bool exclusive = (access == ACCESS_EXCLUSIVE
+                    || access == ACCESS_OVERWRITE);
+
+  for (;;) {
+    struct cached_sector * rs = NULL;
+    struct list_elem *e;
+
+    lock_acquire(&b->lock);
+    for (e = list_begin(&b->sectors); e != list_end (&b->sectors);
+         e = list_next (e)) {
+      struct cached_sector * tmp = list_entry(e, struct cached_sector, elem);
+      if (tmp->sector_idx == sector_idx) {
+        rs = tmp;
+        break;
+      }
+    }
+
     if (rs != NULL) {
-      rs->data = malloc(DISK_SECTOR_SIZE);
-      if (rs->data) {
-        rs->sector_idx = sector_idx;
-        rs->dirty = false;
-        sema_init(&rs->sema, 0);
-        disk_read(filesys_disk, sector_idx, rs->data);
-        list_push_back(&sectors_list, &rs->elem);
-        count++;
+      /* Hit.  Wait for conflicting holders, including a read or
+         write-back in progress, then recheck that the slot still
+         holds our sector: it may have been evicted meanwhile. */
+      if (read_ahead) {
+        lock_release(&b->lock);
+        return NULL;
+      }
+      b->hit_cnt++;
+      lock_acquire(&rs->lock);
+      if (rs->prefetched) {
+        rs->prefetched = false;
+        b->ra_hit_cnt++;
       }
-      else {
-        free(rs);
-        rs = NULL;
+      lock_release(&b->lock);
+      while (rs->in_use && rs->sector_idx == sector_idx
+             && (rs->exclusive || (exclusive && rs->readers > 0)))
+        cond_wait(&rs->cond, &rs->lock);
+      if (!rs->in_use || rs->sector_idx != sector_idx) {
+        lock_release(&rs->lock);
+        continue;
       }
+      if (exclusive)
+        rs->exclusive = true;
+      else
+        rs->readers++;
+      rs->accessed = true;
+      lock_release(&rs->lock);
+      return rs;
+    }
+    lock_release(&b->lock);
+
+    /* Miss.  Claim a slot and empty it without holding any
+       bucket lock. */
+    rs = pick_victim();
+    if (rs->in_use)
+      evict(rs);
+
+    /* Another thread may have brought the sector in while we
+       were evicting.  If so, give the slot back and use theirs. */
+    lock_acquire(&b->lock);
+    for (e = list_begin(&b->sectors); e != list_end (&b->sectors);
+         e = list_next (e))
+      if (list_entry(e, struct cached_sector, elem)->sector_idx == sector_idx)
+        break;
+    if (e != list_end (&b->sectors)) {
+      lock_release(&b->lock);
+      put_sector(rs);
+      if (read_ahead)
+        return NULL;
+      continue;
     }
+    if (read_ahead)
+      b->ra_cnt++;
+    else
+      b->miss_cnt++;
+    lock_acquire(&rs->lock);
+    rs->sector_idx = sector_idx;
+    rs->in_use = true;
+    rs->accessed = true;
+    rs->prefetched = read_ahead;
+    lock_release(&rs->lock);
+    list_push_front(&b->sectors, &rs->elem);
+    lock_release(&b->lock);
+
+    /* The slot is now findable but held exclusively, so other
+       threads wanting this sector wait for the read to finish. */
+    if (access != ACCESS_OVERWRITE)
+      disk_read(filesys_disk, sector_idx, rs->data);
+    if (!exclusive) {
+      lock_acquire(&rs->lock);
+      rs->exclusive = false;
+      rs->readers = 1;
+      cond_broadcast(&rs->cond, &rs->lock);
+      lock_release(&rs->lock);
+    }
+    return rs;
   }
+}
+
+/* Releases access to S obtained from get_sector() or
+   pick_victim(). */
+static void put_sector(struct cached_sector *s) {
+  lock_acquire(&s->lock);
+  if (s->exclusive)
+    s->exclusive = false;
   else {
-    struct list_elem *e = list_begin(&sectors_list);
-    rs = list_entry(e, struct cached_sector, elem);
-    list_remove(&rs->elem);
-    sema_down(&rs->sema);
-    if (rs->dirty)
-      disk_write(filesys_disk, rs->sector_idx, rs->data);
-    rs->sector_idx = sector_idx;
-    rs->dirty = false;
-    disk_read(filesys_disk, rs->sector_idx, rs->data);
-    list_push_back(&sectors_list, &rs->elem);
+    ASSERT (s->readers > 0);
+    s->readers--;
   }
-  return rs;
+  if (!s->exclusive && s->readers == 0)
+    cond_broadcast(&s->cond, &s->lock);
+  lock_release(&s->lock);
+}
+
+/* Sweeps the clock hand until it finds a free slot, or an
+   unreferenced one that nobody holds, and returns it held
+   exclusively.  Slots referenced since the last sweep get a
+   second chance.  Clean slots are preferred: dirty ones are
+   taken only if two full turns find no clean victim, and then
+   only after the write-back hook has run to completion, and only
+   if they were last modified before it started, so that evicting
+   a dirty sector respects the same ordering as write-behind.  If
+   every slot is busy, yields and tries again.
+
+   The exception: a thread inside the hook, writing the free map,
+   cannot run it again.  It takes dirty sectors covered by the
+   hook's last run if it can, but if no slot at all is clean or
+   covered, it takes any dirty one, out of order, since every
+   other thread that could make progress is waiting for it.  A
+   crash just then may leave that sector on disk referring to a
+   sector the on-disk free map still shows as free. */
+static struct cached_sector * pick_victim(void) {
+  for (;;) {
+    bool inside_hook = false;
+    int pass;
+
+    for (pass = 0; pass < 3; pass++) {
+      bool allow_dirty = pass > 0;
+      uint64_t synced = 0;
+      size_t scanned;
+
+      if (pass == 1)
+        inside_hook = !run_write_back_hook(&synced);
+      else if (pass == 2) {
+        if (!inside_hook)
+          break;
+        synced = UINT64_MAX;
+      }
+      lock_acquire(&clock_lock);
+      for (scanned = 0; scanned < 2 * buffer_cache_size; scanned++) {
+        struct cached_sector *s = &slots[clock_hand];
+        clock_hand = (clock_hand + 1) % buffer_cache_size;
+
+        lock_acquire(&s->lock);
+        if (!s->exclusive && s->readers == 0
+            && (!s->in_use
+                || (!s->accessed
+                    && (!s->dirty
+                        || (allow_dirty && s->dirty_seq <= synced))))) {
+          s->exclusive = true;
+          lock_release(&s->lock);
+          lock_release(&clock_lock);
+          return s;
+        }
+        s->accessed = false;
+        lock_release(&s->lock);
+      }
+      lock_release(&clock_lock);
+    }
+    thread_yield();
+  }
+}
+
+/* Writes back S, which is held exclusively, if it is dirty, and
+   removes it from the hash index.  Threads waiting for the old
+   sector find the slot empty and retry their lookup. */
+static void evict(struct cached_sector *s) {
+  disk_sector_t old_idx = s->sector_idx;
+  struct cache_bucket *b = bucket_of(old_idx);
+
+  ASSERT (s->exclusive);
+  if (s->dirty) {
+    disk_write(filesys_disk, old_idx, s->data);
+    mark_clean(s);
+    sema_up(&write_behind_sema);
+  }
+
+  lock_acquire(&b->lock);
+  b->evict_cnt++;
+  list_remove(&s->elem);
+  lock_acquire(&s->lock);
+  s->in_use = false;
+  cond_broadcast(&s->cond, &s->lock);
+  lock_release(&s->lock);
+  lock_release(&b->lock);
 }
 
 bool write_sector(disk_sector_t sector_idx, off_t sector_ofs, void * buffer, off_t size) {
-  struct cached_sector * s = get_sector(sector_idx);
-  if (s == NULL)
-    return false;
+  struct cached_sector * s;
+  if (sector_ofs == 0 && size == DISK_SECTOR_SIZE)
+    s = get_sector(sector_idx, ACCESS_OVERWRITE);
+  else
+    s = get_sector(sector_idx, ACCESS_EXCLUSIVE);
   memcpy (s->data + sector_ofs, buffer, size);
-  sema_up(&s->sema);
-  s->dirty = true;
+  mark_dirty(s);
+  put_sector(s);
   return true;
 }
 
 bool read_sector(disk_sector_t sector_idx, off_t sector_ofs, void * buffer, off_t size) {
-  struct cached_sector * s = get_sector(sector_idx);
-  if (s == NULL)
-    return false;
+  struct cached_sector * s = get_sector(sector_idx, ACCESS_SHARED);
   memcpy (buffer, s->data + sector_ofs, size);
-  sema_up(&s->sema);
+  put_sector(s);
   return true;
 }
+
+/* Sets SECTOR_IDX to all zeros, without reading it from disk. */
+void zero_sector(disk_sector_t sector_idx) {
+  struct cached_sector * s = get_sector(sector_idx, ACCESS_OVERWRITE);
+  memset (s->data, 0, DISK_SECTOR_SIZE);
+  mark_dirty(s);
+  put_sector(s);
+}
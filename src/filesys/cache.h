@@ -2,20 +2,58 @@
 #define FILESYS_CACHE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 #include "threads/synch.h"
 #include <list.h>
 
+/* Default number of sectors held by the buffer cache. */
+#define BUFFER_CACHE_DEFAULT_SIZE 64
+
+/* One slot of the buffer cache.  The slots are one malloc()'d
+   array, and the sector buffers they point to are carved out of
+   one run of pages from palloc_get_multiple(), both allocated at
+   startup.
+
+   Access to DATA is shared/exclusive: any number of readers, or
+   one exclusive holder.  A slot being read in from or written
+   back to disk on behalf of eviction is held exclusively for the
+   duration of the I/O, so threads wanting that sector wait on
+   COND instead of issuing a second read.  LOCK protects the
+   bookkeeping members below and is never held across disk I/O. */
 struct cached_sector {
-  struct list_elem elem;
-  disk_sector_t sector_idx;
-  void * data;
-  bool dirty;
-  struct semaphore sema;
+  struct list_elem elem;        /* Element in a hash bucket. */
+  struct list_elem dirty_elem;  /* Element in dirty list, if dirty. */
+  disk_sector_t sector_idx;     /* Cached sector, if in_use. */
+  void * data;                  /* DISK_SECTOR_SIZE bytes. */
+  bool in_use;                  /* Holds a sector? */
+  bool dirty;                   /* Modified since last written?
+                                   Changes only under dirty_lock. */
+  uint64_t dirty_seq;           /* Stamp of the last modification. */
+  uint64_t dirty_since;         /* Stamp of the first modification
+                                   not yet written back. */
+  bool accessed;                /* Clock reference bit. */
+  bool prefetched;              /* Read ahead, not yet demanded? */
+  struct lock lock;             /* Guards the members below. */
+  struct condition cond;        /* Signaled when access is released. */
+  int readers;                  /* Number of shared holders. */
+  bool exclusive;               /* Held exclusively (or in I/O)? */
 };
 
-void buffer_cache_init();
+/* Capacity of the buffer cache in sectors (-bc). */
+extern size_t buffer_cache_size;
+
+void buffer_cache_init(void);
 bool write_sector(disk_sector_t, off_t, void *, off_t);
 bool read_sector(disk_sector_t, off_t, void *, off_t);
+void read_ahead_sector(disk_sector_t);
+void zero_sector(disk_sector_t);
+void flush(void);
+void flush_sector(disk_sector_t);
+void buffer_cache_set_write_back_hook(bool (*hook) (void));
+uint64_t buffer_cache_stamp(void);
+uint64_t buffer_cache_written_stamp(void);
+void buffer_cache_print_stats(void);
 #endif
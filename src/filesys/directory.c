@@ -5,6 +5,7 @@
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
@@ -34,10 +35,8 @@ dir_create (disk_sector_t sector, size_t entry_cnt, disk_sector_t parent)
 struct dir *
 dir_open (struct inode *inode) 
 {
-  if (inode->removed)
-    return false;
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  if (inode != NULL && dir != NULL && !inode->removed)
     {
       dir->inode = inode;
       dir->pos = 0;
@@ -113,6 +112,20 @@ lookup (const struct dir *dir, const char *name,
   return false;
 }
 
+/* Returns true if directory INODE has no entries in use. */
+static bool
+is_empty (struct inode *inode) 
+{
+  struct dir_entry e;
+  size_t ofs;
+
+  for (ofs = 0; inode_read_at (inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e) 
+    if (e.in_use)
+      return false;
+  return true;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
@@ -126,10 +139,12 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (&dir->inode->lock);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  lock_release (&dir->inode->lock);
 
   return *inode != NULL;
 }
@@ -138,8 +153,8 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), if DIR has been
+   removed, or if a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) 
 {
@@ -154,8 +169,10 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  /* Check that NAME is not in use and that DIR has not been
+     removed, which happens under the same lock. */
+  lock_acquire (&dir->inode->lock);
+  if (dir->inode->removed || lookup (dir, name, NULL, NULL))
     goto done;
 
   /* Set OFS to offset of free slot.
@@ -177,12 +194,19 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
  done:
+  lock_release (&dir->inode->lock);
   return success;
 }
 
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs
+   only if there is no file with the given NAME or if NAME is a
+   directory that is not empty.
+
+   Takes DIR's lock and then the lock of the inode being
+   removed, so that a directory cannot gain an entry between
+   the check that it is empty and its removal.  Locks are
+   always taken in this parent-then-child order. */
 bool
 dir_remove (struct dir *dir, const char *name, bool remove_inode) 
 {
@@ -195,6 +219,7 @@ dir_remove (struct dir *dir, const char *name, bool remove_inode)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  lock_acquire (&dir->inode->lock);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -203,10 +228,15 @@ dir_remove (struct dir *dir, const char *name, bool remove_inode)
   if (inode == NULL)
     goto done;
 
+  /* Refuse to remove a directory that still has entries. */
+  lock_acquire (&inode->lock);
+  if (inode->data.is_dir && !is_empty (inode))
+    goto done_inode;
+
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
-    goto done;
+    goto done_inode;
 
   /* Remove inode. */
   if (remove_inode)
@@ -214,7 +244,10 @@ dir_remove (struct dir *dir, const char *name, bool remove_inode)
 
   success = true;
 
+ done_inode:
+  lock_release (&inode->lock);
  done:
+  lock_release (&dir->inode->lock);
   inode_close (inode);
   return success;
 }
@@ -226,15 +259,19 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
 
+  lock_acquire (&dir->inode->lock);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          success = true;
+          break;
         } 
     }
-  return false;
+  lock_release (&dir->inode->lock);
+  return success;
 }
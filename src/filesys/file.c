@@ -2,6 +2,11 @@
 #include <debug.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "devices/disk.h"
+
+/* Read-ahead window bounds, in sectors. */
+#define READ_AHEAD_MIN 4
+#define READ_AHEAD_MAX 32
 
 /* An open file. */
 struct file 
@@ -9,8 +14,15 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Sequential read detection. */
+    off_t ra_next;              /* Offset a sequential read starts at. */
+    off_t ra_end;               /* End of range already read ahead. */
+    int ra_window;              /* Read-ahead window in sectors, or 0. */
   };
 
+static void read_ahead (struct file *, off_t ofs, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +35,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -69,10 +83,44 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
 
+/* Notes that SIZE bytes were just read from FILE at offset OFS.
+   While reads stay sequential, keeps the next READ_AHEAD_MIN to
+   READ_AHEAD_MAX sectors queued for read-ahead, doubling the
+   window on each sequential read.  Any seek resets it. */
+static void
+read_ahead (struct file *file, off_t ofs, off_t size) 
+{
+  off_t start, end;
+
+  if (size <= 0)
+    return;
+  if (ofs != file->ra_next)
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  else if (file->ra_window == 0)
+    file->ra_window = READ_AHEAD_MIN;
+  else if (file->ra_window < READ_AHEAD_MAX)
+    file->ra_window *= 2;
+  file->ra_next = ofs + size;
+  if (file->ra_window == 0)
+    return;
+
+  start = file->ra_end > file->ra_next ? file->ra_end : file->ra_next;
+  end = file->ra_next + file->ra_window * DISK_SECTOR_SIZE;
+  if (start < end)
+    {
+      inode_read_ahead (file->inode, start, end - start);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
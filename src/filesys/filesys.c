@@ -39,8 +39,13 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  /* Write everything back in order while the free map is still
+     open, then the free map itself, then its file's inode and
+     anything else closing it touched. */
+  flush();
   free_map_close ();
   flush();
+  buffer_cache_print_stats();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -1,12 +1,135 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/cache.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static struct lock free_map_lock;    /* Guards everything here. */
+
+/* The free map file is written a sector-sized part at a time.
+   DIRTY_PARTS marks parts changed in memory and not yet written
+   to the file (that is, to the buffer cache); UNSYNCED_PARTS
+   marks parts written to the file but perhaps not yet to disk.
+
+   Crash-safe ordering: the free map on disk must never show a
+   sector as free while on-disk metadata refers to it.  So before
+   the buffer cache writes back dirty sectors, for write-behind,
+   sync or eviction, it calls free_map_sync(), which pushes the
+   changed parts of the free map all the way to disk first.  A
+   newly allocated sector is thus marked in use on disk no later
+   than any inode or block map pointing to it.
+
+   The other way round, a released sector must not show as free,
+   on disk or for reuse, while metadata on disk still refers to
+   it.  So free_map_release() only queues the sectors on PENDING,
+   stamped (see buffer_cache_stamp()) once the operation that
+   dropped them is done: at once, or at the end of the thread's
+   batch.  free_map_sync() frees them only when the buffer cache
+   has written back every modification up to that stamp.  A crash
+   may thus leak, but never share, sectors, except as noted in
+   pick_victim() in cache.c. */
+static struct bitmap *dirty_parts;
+static struct bitmap *unsynced_parts;
+
+/* A released run of sectors not yet free. */
+struct pending_release
+  {
+    struct list_elem elem;           /* Element in PENDING. */
+    disk_sector_t sector;            /* First sector. */
+    size_t cnt;                      /* Number of sectors. */
+    struct thread *owner;            /* Batching thread, or null. */
+    uint64_t stamp;                  /* Stamp, once OWNER is null. */
+  };
+static struct list pending;
+
+/* Between free_map_begin() and the matching free_map_end(), the
+   calling thread's changes are not written to the file, so that
+   a multi-sector operation writes each part once.  Batches are
+   per thread (see struct thread's free_map_batch), so one
+   thread's batch never holds back another thread's changes, and
+   free_map_sync() writes all changed parts regardless. */
+
+#define PART_BITS (DISK_SECTOR_SIZE * 8)
+
+/* Marks the parts holding bits START through START + CNT - 1 as
+   changed. */
+static void
+mark_parts (size_t start, size_t cnt) 
+{
+  size_t first = start / PART_BITS;
+  size_t last = (start + cnt - 1) / PART_BITS;
+  bitmap_set_multiple (dirty_parts, first, last - first + 1, true);
+}
+
+/* Writes the changed parts of the free map to its file.  Returns
+   false if a write failed. */
+static bool
+write_parts (void) 
+{
+  size_t part;
+
+  if (free_map_file == NULL)
+    return true;
+  for (part = 0; part < bitmap_size (dirty_parts); part++)
+    if (bitmap_test (dirty_parts, part))
+      {
+        if (!bitmap_write_part (free_map, free_map_file,
+                                part * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE))
+          return false;
+        bitmap_reset (dirty_parts, part);
+        bitmap_mark (unsynced_parts, part);
+      }
+  return true;
+}
+
+/* Writes the changed parts of the free map to its file, unless
+   the current thread has a batch open.  Returns false if a write
+   failed. */
+static bool
+persist (void) 
+{
+  if (thread_current ()->free_map_batch > 0)
+    return true;
+  return write_parts ();
+}
+
+/* Frees the pending releases whose stamps the buffer cache has
+   written back through.  Returns true if it freed any. */
+static bool
+apply_releases (void) 
+{
+  uint64_t written;
+  struct list_elem *e;
+  bool applied = false;
+
+  if (list_empty (&pending))
+    return false;
+  written = buffer_cache_written_stamp ();
+  for (e = list_begin (&pending); e != list_end (&pending); )
+    {
+      struct pending_release *p = list_entry (e, struct pending_release,
+                                              elem);
+      e = list_next (e);
+      if (p->owner == NULL && p->stamp <= written)
+        {
+          ASSERT (bitmap_all (free_map, p->sector, p->cnt));
+          bitmap_set_multiple (free_map, p->sector, p->cnt, false);
+          mark_parts (p->sector, p->cnt);
+          list_remove (&p->elem);
+          free (p);
+          applied = true;
+        }
+    }
+  return applied;
+}
 
 /* Initializes the free map. */
 void
@@ -17,6 +140,14 @@ free_map_init (void)
     PANIC ("bitmap creation failed--disk is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  dirty_parts = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                             DISK_SECTOR_SIZE));
+  unsynced_parts = bitmap_create (bitmap_size (dirty_parts));
+  if (dirty_parts == NULL || unsynced_parts == NULL)
+    PANIC ("bitmap creation failed--disk is too large");
+  list_init (&pending);
+  lock_init (&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -26,26 +157,186 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) 
 {
-  disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  disk_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector == BITMAP_ERROR && apply_releases ())
+    sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark_parts (sector, cnt);
+      if (!persist ())
+        {
+          bitmap_set_multiple (free_map, sector, cnt, false); 
+          sector = BITMAP_ERROR;
+        }
     }
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Allocates up to CNT consecutive sectors, as close as
+   possible to GOAL, and stores the first into *SECTORP.  Returns
+   the number of sectors allocated, which is 0 only if the disk
+   is full.
+
+   Takes, in order of preference: the free run that starts at
+   GOAL; the first run of CNT free sectors after GOAL, or failing
+   that after sector 0; or the first free sector after GOAL or 0,
+   together with as many free sectors as follow it. */
+size_t
+free_map_allocate_near (disk_sector_t goal, size_t cnt,
+                        disk_sector_t *sectorp) 
+{
+  size_t size = bitmap_size (free_map);
+  size_t start, n;
+
+  ASSERT (cnt > 0);
+  if (goal >= size)
+    goal = 0;
+
+  lock_acquire (&free_map_lock);
+
+  for (;;)
+    {
+      start = goal;
+      if (!bitmap_test (free_map, start))
+        break;
+      start = bitmap_scan (free_map, goal, cnt, false);
+      if (start == BITMAP_ERROR)
+        start = bitmap_scan (free_map, 0, cnt, false);
+      if (start == BITMAP_ERROR)
+        start = bitmap_scan (free_map, goal, 1, false);
+      if (start == BITMAP_ERROR)
+        start = bitmap_scan (free_map, 0, 1, false);
+      if (start != BITMAP_ERROR)
+        break;
+      if (!apply_releases ())
+        {
+          lock_release (&free_map_lock);
+          return 0;
+        }
+    }
+  for (n = 1; n < cnt && start + n < size; n++)
+    if (bitmap_test (free_map, start + n))
+      break;
+
+  bitmap_set_multiple (free_map, start, n, true);
+  mark_parts (start, n);
+  if (!persist ())
+    {
+      bitmap_set_multiple (free_map, start, n, false);
+      n = 0;
+    }
+  else
+    *sectorp = start;
+  lock_release (&free_map_lock);
+  return n;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, once
+   the metadata that referred to them is on disk.  The caller must
+   already have dropped those references, or drop them before
+   ending its batch.  If memory runs out, the sectors are leaked
+   instead. */
 void
 free_map_release (disk_sector_t sector, size_t cnt)
 {
+  struct thread *t = thread_current ();
+  struct pending_release *p;
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  p = malloc (sizeof *p);
+  if (p != NULL)
+    {
+      p->sector = sector;
+      p->cnt = cnt;
+      p->owner = t->free_map_batch > 0 ? t : NULL;
+      p->stamp = p->owner == NULL ? buffer_cache_stamp () : 0;
+      list_push_back (&pending, &p->elem);
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Starts a batch of free map changes by the current thread.
+   Batches nest. */
+void
+free_map_begin (void) 
+{
+  thread_current ()->free_map_batch++;
+}
+
+/* Ends a batch of free map changes.  When the thread's outermost
+   batch ends, stamps the sectors it released and writes the parts
+   of the free map changed so far. */
+void
+free_map_end (void) 
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->free_map_batch > 0);
+  if (--t->free_map_batch == 0)
+    {
+      /* Writing the free map file itself nests a batch inside a
+         free map operation, which will persist the changes. */
+      bool nested = lock_held_by_current_thread (&free_map_lock);
+      uint64_t stamp = buffer_cache_stamp ();
+      struct list_elem *e;
+
+      if (!nested)
+        lock_acquire (&free_map_lock);
+      for (e = list_begin (&pending); e != list_end (&pending);
+           e = list_next (e))
+        {
+          struct pending_release *p = list_entry (e, struct pending_release,
+                                                  elem);
+          if (p->owner == t)
+            {
+              p->owner = NULL;
+              p->stamp = stamp;
+            }
+        }
+      if (!nested)
+        {
+          persist ();
+          lock_release (&free_map_lock);
+        }
+    }
+}
+
+/* Frees the pending releases that are now safe to free, then
+   writes every changed part of the free map through to disk,
+   including parts changed within open batches.  Installed as the
+   buffer cache's write-back hook; see the ordering rule above.
+   Does nothing and returns false if called, through the buffer
+   cache, from within a free map operation; otherwise returns
+   true. */
+bool
+free_map_sync (void) 
+{
+  size_t part;
+
+  if (lock_held_by_current_thread (&free_map_lock))
+    return false;
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    {
+      apply_releases ();
+      write_parts ();
+      for (part = 0; part < bitmap_size (unsynced_parts); part++)
+        if (bitmap_test (unsynced_parts, part))
+          {
+            struct inode *inode = file_get_inode (free_map_file);
+            flush_sector (inode_get_sector (inode, part * DISK_SECTOR_SIZE));
+            bitmap_reset (unsynced_parts, part);
+          }
+    }
+  lock_release (&free_map_lock);
+  return true;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -57,13 +348,17 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  buffer_cache_set_write_back_hook (free_map_sync);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_sync ();
+  buffer_cache_set_write_back_hook (NULL);
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -71,14 +366,24 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), 0, 0))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The file starts out as a hole, so this
+     first write allocates its sectors, changing the map as it
+     goes; write it again, in full, once that has settled. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, file))
+    PANIC ("can't write free map");
+  lock_acquire (&free_map_lock);
+  free_map_file = file;
+  bitmap_set_all (dirty_parts, true);
+  if (!persist ())
     PANIC ("can't write free map");
+  lock_release (&free_map_lock);
 }
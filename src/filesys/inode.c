@@ -9,8 +9,36 @@
 #include "threads/malloc.h"
 #include "threads/synch.h"
 
-/* Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+/* Identify an inode and its block map format. */
+#define INODE_MAGIC 0x494e4f44          /* Doubly-indirect table. */
+#define INODE_EXTENT_MAGIC 0x494e4f45   /* Extents. */
+
+/* Sector pointers per indirect block, in the doubly-indirect
+   format. */
+#define PTRS_PER_SECTOR 128
+
+/* Extents past the first INODE_INLINE_EXTENTS live in leaf
+   sectors of EXTENTS_PER_LEAF extents each.  A root sector lists
+   the leaves in order, each with the file block its first extent
+   maps, so that a lookup reads one root entry per step of a
+   binary search and then one leaf. */
+struct extent_root_entry
+  {
+    uint32_t first_block;               /* File block of first extent. */
+    disk_sector_t leaf;                 /* Leaf sector. */
+  };
+
+#define EXTENTS_PER_LEAF (DISK_SECTOR_SIZE / sizeof (struct inode_extent))
+#define LEAVES_PER_ROOT (DISK_SECTOR_SIZE / sizeof (struct extent_root_entry))
+#define MAX_EXTENTS (INODE_INLINE_EXTENTS + LEAVES_PER_ROOT * EXTENTS_PER_LEAF)
+
+/* Shape of the in-memory block map cache.  Each chunk holds
+   MAP_CHUNK_ENTRIES translations; an inode caches at most
+   MAP_MAX_CHUNKS chunks (16 kB), for blocks below
+   MAP_TOP_ENTRIES * MAP_CHUNK_ENTRIES (8 MB of file). */
+#define MAP_CHUNK_ENTRIES 128
+#define MAP_TOP_ENTRIES 128
+#define MAP_MAX_CHUNKS 32
 
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
@@ -20,34 +48,655 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
+/* Returns true if D maps its blocks with extents. */
+static inline bool
+is_extent_map (const struct inode_disk *d)
+{
+  return d->magic == INODE_EXTENT_MAGIC;
+}
+
+/* Reads the entry for leaf L from D's extent root. */
+static void
+read_root_entry (const struct inode_disk *d, size_t l,
+                 struct extent_root_entry *r)
+{
+  read_sector (d->doubly_indirect, l * sizeof *r, r, sizeof *r);
+}
+
+/* Stores D's extent number E in *X. */
+static void
+get_extent (const struct inode_disk *d, size_t e, struct inode_extent *x)
+{
+  struct extent_root_entry r;
+
+  ASSERT (e < d->extent_cnt);
+  if (e < INODE_INLINE_EXTENTS)
+    {
+      *x = d->extents[e];
+      return;
+    }
+  e -= INODE_INLINE_EXTENTS;
+  read_root_entry (d, e / EXTENTS_PER_LEAF, &r);
+  read_sector (r.leaf, e % EXTENTS_PER_LEAF * sizeof *x, x, sizeof *x);
+}
+
+/* Sets D's extent number E to *X.  Inline extents change only in
+   D; the caller writes D back. */
+static void
+set_extent (struct inode_disk *d, size_t e, struct inode_extent *x)
+{
+  struct extent_root_entry r;
+
+  ASSERT (e < d->extent_cnt);
+  if (e < INODE_INLINE_EXTENTS)
+    {
+      d->extents[e] = *x;
+      return;
+    }
+  e -= INODE_INLINE_EXTENTS;
+  read_root_entry (d, e / EXTENTS_PER_LEAF, &r);
+  write_sector (r.leaf, e % EXTENTS_PER_LEAF * sizeof *x, x, sizeof *x);
+}
+
+/* Returns the number of overflow leaves needed for CNT extents. */
+static inline size_t
+leaves_for (size_t cnt)
+{
+  return (cnt > INODE_INLINE_EXTENTS
+          ? DIV_ROUND_UP (cnt - INODE_INLINE_EXTENTS, EXTENTS_PER_LEAF)
+          : 0);
+}
+
+/* Returns the disk sector for block OFS within extent X, or 0 if
+   X is a hole. */
+static inline disk_sector_t
+extent_sector (const struct inode_extent *x, size_t ofs)
+{
+  return x->start != 0 ? x->start + ofs : 0;
+}
+
+/* Returns the disk sector holding file block N of D, which uses
+   extents, 0 if N lies in a hole, or -1 if there is none.  Files
+   with no more than INODE_INLINE_EXTENTS extents need no disk
+   access. */
+static disk_sector_t
+extent_lookup (const struct inode_disk *d, size_t n)
+{
+  struct inode_extent leaf[EXTENTS_PER_LEAF];
+  struct extent_root_entry r;
+  size_t inline_cnt, leaf_cnt, lo, hi, e, ext_cnt, first;
+
+  inline_cnt = (d->extent_cnt < INODE_INLINE_EXTENTS
+                ? d->extent_cnt : INODE_INLINE_EXTENTS);
+  first = 0;
+  for (e = 0; e < inline_cnt; e++)
+    {
+      if (n < first + d->extents[e].length)
+        return extent_sector (&d->extents[e], n - first);
+      first += d->extents[e].length;
+    }
+  if (d->extent_cnt <= INODE_INLINE_EXTENTS)
+    return -1;
+
+  /* Find the last leaf whose first block is at most N. */
+  leaf_cnt = leaves_for (d->extent_cnt);
+  lo = 0;
+  hi = leaf_cnt;
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      read_root_entry (d, mid, &r);
+      if (r.first_block <= n)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  read_root_entry (d, lo, &r);
+
+  ext_cnt = d->extent_cnt - INODE_INLINE_EXTENTS - lo * EXTENTS_PER_LEAF;
+  if (ext_cnt > EXTENTS_PER_LEAF)
+    ext_cnt = EXTENTS_PER_LEAF;
+  read_sector (r.leaf, 0, leaf, ext_cnt * sizeof *leaf);
+  first = r.first_block;
+  for (e = 0; e < ext_cnt; e++)
+    {
+      if (n < first + leaf[e].length)
+        return extent_sector (&leaf[e], n - first);
+      first += leaf[e].length;
+    }
+  return -1;
+}
+
+/* Returns the disk sector holding file block N of D, or 0 if N
+   lies in a hole. */
+static disk_sector_t
+block_lookup (const struct inode_disk *d, size_t n)
+{
+  disk_sector_t indirect, direct;
+
+  if (is_extent_map (d))
+    return extent_lookup (d, n);
+  read_sector (d->doubly_indirect, 4 * (n / PTRS_PER_SECTOR), &indirect, 4);
+  read_sector (indirect, 4 * (n % PTRS_PER_SECTOR), &direct, 4);
+  return direct;
+}
+
+/* Frees D's overflow leaves from KEEP_LEAVES up to HAVE_LEAVES,
+   and its overflow root too if KEEP_LEAVES is 0. */
+static void
+extent_release_overflow (struct inode_disk *d, size_t have_leaves,
+                         size_t keep_leaves)
+{
+  size_t l;
+
+  for (l = keep_leaves; l < have_leaves; l++)
+    {
+      struct extent_root_entry r;
+      read_root_entry (d, l, &r);
+      free_map_release (r.leaf, 1);
+    }
+  if (keep_leaves == 0 && d->doubly_indirect != 0)
+    {
+      free_map_release (d->doubly_indirect, 1);
+      d->doubly_indirect = 0;
+    }
+}
+
+/* Makes sure D has overflow sectors for NEW_CNT extents,
+   allocating them near GOAL.  New leaves are recorded as starting
+   at file block FIRST_BLOCK.  Returns false if out of disk
+   space. */
+static bool
+extent_reserve (struct inode_disk *d, size_t new_cnt, size_t first_block,
+                disk_sector_t goal)
+{
+  size_t old_leaves = leaves_for (d->extent_cnt);
+  size_t new_leaves = leaves_for (new_cnt);
+  size_t l;
+
+  if (new_leaves <= old_leaves)
+    return true;
+  if (old_leaves == 0
+      && free_map_allocate_near (goal, 1, &d->doubly_indirect) == 0)
+    return false;
+  for (l = old_leaves; l < new_leaves; l++)
+    {
+      struct extent_root_entry r;
+      r.first_block = first_block;
+      if (free_map_allocate_near (goal, 1, &r.leaf) == 0)
+        break;
+      write_sector (d->doubly_indirect, l * sizeof r, &r, sizeof r);
+    }
+  if (l == new_leaves)
+    return true;
+  extent_release_overflow (d, l, old_leaves);
+  return false;
+}
+
+/* Recomputes the first file block recorded for each of D's
+   overflow leaves, after extents have moved between leaves. */
+static void
+extent_fix_root (struct inode_disk *d)
+{
+  struct inode_extent x;
+  size_t e, first = 0;
+
+  for (e = 0; e < d->extent_cnt; e++)
+    {
+      if (e >= INODE_INLINE_EXTENTS
+          && (e - INODE_INLINE_EXTENTS) % EXTENTS_PER_LEAF == 0)
+        {
+          struct extent_root_entry r;
+          size_t l = (e - INODE_INLINE_EXTENTS) / EXTENTS_PER_LEAF;
+          read_root_entry (d, l, &r);
+          r.first_block = first;
+          write_sector (d->doubly_indirect, l * sizeof r, &r, sizeof r);
+        }
+      get_extent (d, e, &x);
+      first += x.length;
+    }
+}
+
+/* Appends LENGTH blocks to D, which uses extents and currently
+   maps N blocks.  The new blocks map to consecutive sectors from
+   START or, if START is 0, form a hole.  Returns false if out of
+   disk space or extents. */
+static bool
+extent_append (struct inode_disk *d, size_t n, disk_sector_t start,
+               size_t length)
+{
+  struct inode_extent x;
+  size_t cnt = d->extent_cnt;
+
+  /* Lengthen the last extent if the new blocks continue it. */
+  if (cnt > 0)
+    {
+      get_extent (d, cnt - 1, &x);
+      if (start == 0
+          ? x.start == 0
+          : x.start != 0 && x.start + x.length == start)
+        {
+          x.length += length;
+          set_extent (d, cnt - 1, &x);
+          return true;
+        }
+    }
+
+  if (cnt >= MAX_EXTENTS
+      || !extent_reserve (d, cnt + 1, n, start != 0 ? start + length : 0))
+    return false;
+  x.start = start;
+  x.length = length;
+  d->extent_cnt++;
+  set_extent (d, cnt, &x);
+  return true;
+}
+
+/* Replaces D's extent E by the K extents in PARTS, which must
+   cover the same number of blocks, moving later extents up or
+   down as needed.  New overflow sectors are allocated near GOAL.
+   Returns false if out of disk space or extents, in which case D
+   is unchanged. */
+static bool
+extent_splice (struct inode_disk *d, size_t e, struct inode_extent parts[],
+               size_t k, disk_sector_t goal)
+{
+  size_t old_cnt = d->extent_cnt;
+  size_t new_cnt = old_cnt - 1 + k;
+  struct inode_extent x;
+  size_t i;
+
+  if (new_cnt > old_cnt)
+    {
+      if (new_cnt > MAX_EXTENTS || !extent_reserve (d, new_cnt, 0, goal))
+        return false;
+      d->extent_cnt = new_cnt;
+      for (i = old_cnt; i-- > e + 1; )
+        {
+          get_extent (d, i, &x);
+          set_extent (d, i + k - 1, &x);
+        }
+    }
+  else if (new_cnt < old_cnt)
+    for (i = e + 1; i < old_cnt; i++)
+      {
+        get_extent (d, i, &x);
+        set_extent (d, i - 1, &x);
+      }
+
+  for (i = 0; i < k; i++)
+    set_extent (d, e + i, &parts[i]);
+
+  if (new_cnt < old_cnt)
+    {
+      extent_release_overflow (d, leaves_for (old_cnt), leaves_for (new_cnt));
+      d->extent_cnt = new_cnt;
+    }
+  if (new_cnt != old_cnt)
+    extent_fix_root (d);
+  return true;
+}
+
+/* Finds the extent of D that holds file block N, and stores its
+   index in *E, the extent itself in *X, and the file block it
+   starts at in *FIRST. */
+static void
+extent_find (const struct inode_disk *d, size_t n, size_t *e,
+             struct inode_extent *x, size_t *first)
+{
+  *first = 0;
+  for (*e = 0; *e < d->extent_cnt; (*e)++)
+    {
+      get_extent (d, *e, x);
+      if (n < *first + x->length)
+        return;
+      *first += x->length;
+    }
+  NOT_REACHED ();
+}
+
+/* Returns the best sector for file block N of D, which lies in a
+   hole: the one that would continue the allocated extent before
+   the hole, leaving room to fill the rest of the hole in order,
+   or else one just past D's own sector SELF. */
+static disk_sector_t
+extent_goal (const struct inode_disk *d, disk_sector_t self, size_t n)
+{
+  struct inode_extent x, prev;
+  size_t e, first;
+
+  extent_find (d, n, &e, &x, &first);
+  if (e > 0)
+    {
+      get_extent (d, e - 1, &prev);
+      if (prev.start != 0)
+        return prev.start + prev.length + (n - first);
+    }
+  return self + 1 + n;
+}
+
+/* Maps the CNT file blocks of D starting at N, which all lie in
+   one hole, to consecutive sectors from START.  Holes are never
+   adjacent, so the extent before a hole is always allocated.
+   Returns false if out of disk space or extents. */
+static bool
+extent_fill (struct inode_disk *d, size_t n, size_t cnt, disk_sector_t start)
+{
+  struct inode_extent x, prev, parts[3];
+  size_t e, first, before, after, k;
+
+  extent_find (d, n, &e, &x, &first);
+  ASSERT (x.start == 0);
+  ASSERT (n + cnt <= first + x.length);
+  before = n - first;
+  after = first + x.length - n - cnt;
+
+  /* Common case: filling a hole from its start, in order, so that
+     START continues the previous extent. */
+  if (before == 0 && e > 0)
+    {
+      get_extent (d, e - 1, &prev);
+      if (prev.start + prev.length == start)
+        {
+          prev.length += cnt;
+          set_extent (d, e - 1, &prev);
+          if (after == 0)
+            return extent_splice (d, e, parts, 0, start);
+          x.length -= cnt;
+          set_extent (d, e, &x);
+
+          /* The hole now starts CNT blocks later.  If it heads an
+             overflow leaf, so does the leaf. */
+          if (e >= INODE_INLINE_EXTENTS
+              && (e - INODE_INLINE_EXTENTS) % EXTENTS_PER_LEAF == 0)
+            {
+              struct extent_root_entry r;
+              size_t l = (e - INODE_INLINE_EXTENTS) / EXTENTS_PER_LEAF;
+              read_root_entry (d, l, &r);
+              r.first_block += cnt;
+              write_sector (d->doubly_indirect, l * sizeof r, &r, sizeof r);
+            }
+          return true;
+        }
+    }
+
+  /* Otherwise split the hole around the new blocks. */
+  k = 0;
+  if (before > 0)
+    {
+      parts[k].start = 0;
+      parts[k++].length = before;
+    }
+  parts[k].start = start;
+  parts[k++].length = cnt;
+  if (after > 0)
+    {
+      parts[k].start = 0;
+      parts[k++].length = after;
+    }
+  return extent_splice (d, e, parts, k, start + cnt);
+}
+
+/* Maps file block N of D, which must be the first block past the
+   current end of the file, to disk sector SECTOR.  Allocates map
+   sectors as needed.  Returns false if out of disk space or, for
+   extents, if D already has MAX_EXTENTS extents and SECTOR does
+   not continue the last one. */
+static bool
+block_append (struct inode_disk *d, size_t n, disk_sector_t sector)
+{
+  disk_sector_t indirect;
+
+  if (is_extent_map (d))
+    return extent_append (d, n, sector, 1);
+
+  if (n % PTRS_PER_SECTOR == 0)
+    {
+      if (free_map_allocate_near (sector + 1, 1, &indirect) == 0)
+        return false;
+      write_sector (d->doubly_indirect, 4 * (n / PTRS_PER_SECTOR),
+                    &indirect, 4);
+    }
+  else
+    read_sector (d->doubly_indirect, 4 * (n / PTRS_PER_SECTOR),
+                 &indirect, 4);
+  write_sector (indirect, 4 * (n % PTRS_PER_SECTOR), &sector, 4);
+  return true;
+}
+
+/* Shrinks D from CNT to KEEP mapped blocks, releasing the data
+   sectors past KEEP and any map sectors no longer needed.  The
+   doubly-indirect table itself is kept. */
+static void
+block_truncate (struct inode_disk *d, size_t cnt, size_t keep)
+{
+  struct inode_extent x;
+  size_t i, e, first, new_cnt;
+
+  if (!is_extent_map (d))
+    {
+      for (i = keep; i < cnt; i++)
+        {
+          disk_sector_t indirect, direct;
+          read_sector (d->doubly_indirect, 4 * (i / PTRS_PER_SECTOR),
+                       &indirect, 4);
+          read_sector (indirect, 4 * (i % PTRS_PER_SECTOR), &direct, 4);
+          free_map_release (direct, 1);
+          if ((i % PTRS_PER_SECTOR == PTRS_PER_SECTOR - 1 || i == cnt - 1)
+              && i / PTRS_PER_SECTOR * PTRS_PER_SECTOR >= keep)
+            free_map_release (indirect, 1);
+        }
+      return;
+    }
+
+  first = 0;
+  new_cnt = 0;
+  for (e = 0; e < d->extent_cnt; e++)
+    {
+      size_t length;
+
+      get_extent (d, e, &x);
+      length = x.length;
+      if (first >= keep)
+        {
+          if (x.start != 0)
+            free_map_release (x.start, x.length);
+        }
+      else
+        {
+          if (first + x.length > keep)
+            {
+              if (x.start != 0)
+                free_map_release (x.start + (keep - first),
+                                  first + x.length - keep);
+              x.length = keep - first;
+              set_extent (d, e, &x);
+            }
+          new_cnt = e + 1;
+        }
+      first += length;
+    }
+
+  extent_release_overflow (d, leaves_for (d->extent_cnt),
+                           leaves_for (new_cnt));
+  d->extent_cnt = new_cnt;
+}
+
+/* Maps file blocks FROM through TO - 1 of D, which currently
+   has FROM blocks and uses the doubly-indirect format, to newly
+   allocated sectors, zeroed in the buffer cache.  Sectors are
+   allocated in runs placed as close as possible to GOAL and then
+   to the end of the previous run, so that the new blocks are
+   contiguous on disk where free space allows.  On failure,
+   unmaps the new blocks again and returns false. */
+static bool
+block_allocate (struct inode_disk *d, size_t from, size_t to,
+                disk_sector_t goal)
+{
+  size_t i = from;
+  bool ok = true;
+
+  while (ok && i < to)
+    {
+      disk_sector_t start;
+      size_t n, k;
+
+      n = free_map_allocate_near (goal, to - i, &start);
+      if (n == 0)
+        break;
+      for (k = 0; k < n; k++, i++)
+        {
+          zero_sector (start + k);
+          if (!block_append (d, i, start + k))
+            {
+              free_map_release (start + k, n - k);
+              ok = false;
+              break;
+            }
+        }
+      goal = start + n;
+    }
+  if (i == to)
+    return true;
+  block_truncate (d, i, from);
+  return false;
+}
+
+/* Returns INODE's block map chunk covering file block N,
+   allocating it if the inode's budget allows.  Returns a null
+   pointer if N cannot be cached. */
+static disk_sector_t *
+map_chunk (struct inode *inode, size_t n)
+{
+  size_t c = n / MAP_CHUNK_ENTRIES;
+  disk_sector_t *chunk = NULL;
+
+  if (c >= MAP_TOP_ENTRIES)
+    return NULL;
+  if (inode->block_map != NULL && inode->block_map[c] != NULL)
+    return inode->block_map[c];
+  if (inode->block_map_chunks >= MAP_MAX_CHUNKS)
+    return NULL;
+
+  lock_acquire (&inode->block_map_lock);
+  if (inode->block_map == NULL)
+    inode->block_map = calloc (MAP_TOP_ENTRIES, sizeof *inode->block_map);
+  if (inode->block_map != NULL)
+    {
+      chunk = inode->block_map[c];
+      if (chunk == NULL && inode->block_map_chunks < MAP_MAX_CHUNKS)
+        {
+          chunk = calloc (MAP_CHUNK_ENTRIES, sizeof *chunk);
+          if (chunk != NULL)
+            {
+              inode->block_map[c] = chunk;
+              inode->block_map_chunks++;
+            }
+        }
+    }
+  lock_release (&inode->block_map_lock);
+  return chunk;
+}
+
+/* Forgets INODE's cached translations for file blocks START
+   through END - 1. */
+static void
+map_invalidate (struct inode *inode, size_t start, size_t end)
+{
+  size_t n;
+
+  lock_acquire (&inode->block_map_lock);
+  if (inode->block_map != NULL)
+    for (n = start; n < end && n / MAP_CHUNK_ENTRIES < MAP_TOP_ENTRIES; n++)
+      {
+        disk_sector_t *chunk = inode->block_map[n / MAP_CHUNK_ENTRIES];
+        if (chunk != NULL)
+          chunk[n % MAP_CHUNK_ENTRIES] = 0;
+        else
+          n = ROUND_UP (n + 1, MAP_CHUNK_ENTRIES) - 1;
+      }
+  lock_release (&inode->block_map_lock);
+}
+
+/* Frees INODE's block map cache. */
+static void
+map_free (struct inode *inode)
+{
+  size_t c;
+
+  if (inode->block_map == NULL)
+    return;
+  for (c = 0; c < MAP_TOP_ENTRIES; c++)
+    free (inode->block_map[c]);
+  free (inode->block_map);
+  inode->block_map = NULL;
+  inode->block_map_chunks = 0;
+}
+
 /* Returns the disk sector that contains byte offset POS within
    INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS.
+
+   A cached translation never goes stale: only a hole, which is
+   never cached, can be remapped, and fill_block() forgets the
+   block anyway.  A miss walks the block map under
+   file_growth_sema, which every change to the map holds, so the
+   walk cannot see a half-done splice and the translation it
+   caches is current. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  disk_sector_t *chunk, sector;
+  size_t n;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length) {
-    uint32_t n = pos / DISK_SECTOR_SIZE;
-    disk_sector_t indirect, direct;
-    read_sector(inode->data.doubly_indirect, 4 * (n / 128), &indirect, 4);
-    read_sector(indirect, 4 * (n % 128), &direct, 4);
-    return direct;
-  }
-  else
+  if (pos >= inode->data.length)
     return -1;
+
+  n = pos / DISK_SECTOR_SIZE;
+  chunk = map_chunk (inode, n);
+  if (chunk != NULL && chunk[n % MAP_CHUNK_ENTRIES] != 0)
+    return chunk[n % MAP_CHUNK_ENTRIES];
+
+  sema_down (&inode->file_growth_sema);
+  sector = block_lookup (&inode->data, n);
+  if (chunk != NULL)
+    chunk[n % MAP_CHUNK_ENTRIES] = sector;
+  sema_up (&inode->file_growth_sema);
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of open inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt of every inode in it. */
+static struct lock open_inodes_lock;
+
+/* Returns a hash value for the inode that E is embedded in. */
+static unsigned
+open_inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A precedes inode B in sector order. */
+static bool
+open_inode_less (const struct hash_elem *a, const struct hash_elem *b,
+                 void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, open_inode_hash, open_inode_less, NULL))
+    PANIC ("could not allocate open inode table");
+  lock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -58,9 +707,6 @@ inode_init (void)
 bool
 inode_create (disk_sector_t sector, off_t length, int is_dir, disk_sector_t parent)
 {
-  uint32_t i, j;
-  disk_sector_t tmp, indirect;
-  static char zeros[DISK_SECTOR_SIZE];
   struct inode_disk *disk_inode = NULL;
   bool success = false;
 
@@ -77,39 +723,15 @@ inode_create (disk_sector_t sector, off_t length, int is_dir, disk_sector_t pare
       disk_inode->length = length;
       disk_inode->is_dir = is_dir;
       disk_inode->parent = parent;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate(1, &disk_inode->doubly_indirect)) {
-        for (i = 0; i < sectors; i++) {
-          if (!free_map_allocate(1, &tmp))
-            break;
-          else {
-            disk_write(filesys_disk, tmp, zeros);
-            if (i % 128 == 0) {
-              if (!free_map_allocate(1, &indirect)) {
-                free_map_release(tmp, 1);
-                break;
-              }
-              write_sector(disk_inode->doubly_indirect, 4 * (i / 128), &indirect, 4);
-            }
-            write_sector(indirect, 4 * (i % 128), &tmp, 4);
-          }
-        }
-        if (i == sectors) {
+      disk_inode->magic = INODE_EXTENT_MAGIC;
+
+      /* The data starts out as one hole; sectors are allocated
+         as it is written. */
+      if (sectors == 0 || extent_append (disk_inode, 0, 0, sectors))
+        {
           success = true;
           write_sector (sector, 0, disk_inode, DISK_SECTOR_SIZE);
         }
-        else {
-          for (j = 0; j < i; j++) {
-            disk_sector_t indirect, direct;
-            read_sector(disk_inode->doubly_indirect, 4 * (j / 128), &indirect, 4);
-            read_sector(indirect, 4 * (j % 128), &direct, 4);
-            free_map_release(direct, 1);
-            if (j == i - 1 || j % 128 == 127)
-              free_map_release(indirect, 1);
-          }
-          free_map_release(disk_inode->doubly_indirect, 1);
-        }
-      }
       free (disk_inode);
     }
   return success;
@@ -121,34 +743,52 @@ inode_create (disk_sector_t sector, off_t length, int is_dir, disk_sector_t pare
 struct inode *
 inode_open (disk_sector_t sector) 
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  lock_acquire (&open_inodes_lock);
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
+  lock_release (&open_inodes_lock);
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize outside the table lock, so that reading the
+     inode does not hold up opens of unrelated inodes. */
   inode->sector = sector;
   inode->open_cnt = 1;
+  lock_init (&inode->lock);
   inode->deny_write_cnt = 0;
   inode->removed = false;
   read_sector (inode->sector, 0, &inode->data, DISK_SECTOR_SIZE);
   sema_init(&inode->file_growth_sema, 1);
+  inode->block_map = NULL;
+  inode->block_map_chunks = 0;
+  lock_init (&inode->block_map_lock);
+
+  /* Another thread may have opened the same inode meanwhile;
+     if so, use its copy instead. */
+  lock_acquire (&open_inodes_lock);
+  e = hash_insert (&open_inodes, &inode->elem);
+  if (e != NULL)
+    {
+      free (inode);
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+    }
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -157,7 +797,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -174,44 +818,53 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
-  uint32_t i;
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-          size_t sectors = bytes_to_sectors (inode->data.length);
-          for (i = 0; i < sectors; i++) {
-            disk_sector_t indirect, direct;
-            read_sector(inode->data.doubly_indirect, 4 * (i / 128), &indirect, 4);
-            read_sector(indirect, 4 * (i % 128), &direct, 4);
-            free_map_release(direct, 1);
-            if (i == sectors - 1 || i % 128 == 127)
-              free_map_release(indirect, 1);
-          }
-          free_map_release (inode->data.doubly_indirect, 1);
-          free_map_release (inode->sector, 1);
-        }
+      lock_release (&open_inodes_lock);
+      return;
+    }
+  hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
 
-      free (inode); 
+  /* Deallocate blocks if removed. */
+  if (inode->removed) 
+    {
+      free_map_begin ();
+      block_truncate (&inode->data,
+                      bytes_to_sectors (inode->data.length), 0);
+      if (!is_extent_map (&inode->data))
+        free_map_release (inode->data.doubly_indirect, 1);
+      free_map_release (inode->sector, 1);
+      free_map_end ();
     }
+
+  map_free (inode);
+  free (inode); 
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
-   has it open. */
+   has it open.  The caller must hold INODE's lock. */
 void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  ASSERT (lock_held_by_current_thread (&inode->lock));
   inode->removed = true;
+  map_invalidate (inode, 0, bytes_to_sectors (inode->data.length));
+}
+
+/* Returns the disk sector that holds byte OFFSET of INODE, or
+   -1 if OFFSET is past end of file. */
+disk_sector_t
+inode_get_sector (struct inode *inode, off_t offset) 
+{
+  return byte_to_sector (inode, offset);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -238,7 +891,9 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (!read_sector(sector_idx, sector_ofs, buffer + bytes_read, chunk_size))
+      if (sector_idx == 0)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else if (!read_sector(sector_idx, sector_ofs, buffer + bytes_read, chunk_size))
         break;
       /* Advance. */
       size -= chunk_size;
@@ -249,43 +904,124 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   return bytes_read;
 }
 
-/* File growth.
+/* Asks the buffer cache to fetch, in the background, the
+   sectors holding the SIZE bytes of INODE starting at OFFSET.
+   Bytes past end of file are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE); offset < end;
+       offset += DISK_SECTOR_SIZE)
+    {
+      disk_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0)
+        read_ahead_sector (sector);
+    }
+}
+
+/* File growth.  Files in the extent format grow by a hole;
+   older files get zeroed sectors right away.
    Returns true if the operation is successful.
    Returns false otherwise */
 bool file_growth(struct inode *inode, size_t old_nbsectors, size_t new_nbsectors) {
-  uint32_t i, j;
-  bool success = false;
-  disk_sector_t tmp, direct, indirect;
-  static char zeros[DISK_SECTOR_SIZE];
-  if (old_nbsectors % 128)
-    read_sector(inode->data.doubly_indirect, 4 * (old_nbsectors / 128), &indirect, 4);
-  for (i = old_nbsectors; i < new_nbsectors; i++) {
-    if (!free_map_allocate(1, &tmp))
-      break;
-    else {
-      disk_write(filesys_disk, tmp, zeros);
-      if (i % 128 == 0) {
-        if (!free_map_allocate(1, &indirect)) {
-          free_map_release(tmp, 1);
+  disk_sector_t goal;
+  bool success;
+  map_invalidate(inode, old_nbsectors, new_nbsectors);
+  if (is_extent_map(&inode->data)) {
+    free_map_begin();
+    success = extent_append(&inode->data, old_nbsectors, 0,
+                            new_nbsectors - old_nbsectors);
+    free_map_end();
+    return success;
+  }
+  if (old_nbsectors > 0)
+    goal = block_lookup(&inode->data, old_nbsectors - 1) + 1;
+  else
+    goal = inode->sector + 1;
+  free_map_begin();
+  success = block_allocate(&inode->data, old_nbsectors, new_nbsectors, goal);
+  free_map_end();
+  return success;
+}
+
+/* Writes SIZE bytes from BUFFER at byte OFFSET of INODE, where
+   the block holding OFFSET lies in a hole.  Fills as much of the
+   hole as the write covers: allocates one run of sectors for it
+   if the disk allows, writes the data, zeroing the rest of any
+   partly written sector, and only then maps the run as a single
+   extent, so that readers never see what the sectors held
+   before.  Sets *DIRTY if INODE's block map changed and must be
+   written back.  Returns the number of bytes written, which is 0
+   only if the disk is full. */
+static off_t
+fill_block (struct inode *inode, off_t offset, const uint8_t *buffer,
+            off_t size, bool *dirty)
+{
+  size_t n = offset / DISK_SECTOR_SIZE;
+  int sector_ofs = offset % DISK_SECTOR_SIZE;
+  struct inode_extent x;
+  size_t e, first, cnt, got, i;
+  disk_sector_t start;
+  off_t written = 0, run_written;
+
+  sema_down (&inode->file_growth_sema);
+  start = block_lookup (&inode->data, n);
+  if (start != 0)
+    {
+      /* Another writer filled the block first. */
+      int chunk_size = DISK_SECTOR_SIZE - sector_ofs;
+      if (size < chunk_size)
+        chunk_size = size;
+      sema_up (&inode->file_growth_sema);
+      return (write_sector (start, sector_ofs, (void *) buffer, chunk_size)
+              ? chunk_size : 0);
+    }
+
+  /* Blocks of the hole that this write covers. */
+  extent_find (&inode->data, n, &e, &x, &first);
+  cnt = DIV_ROUND_UP (sector_ofs + size, DISK_SECTOR_SIZE);
+  if (cnt > first + x.length - n)
+    cnt = first + x.length - n;
+
+  free_map_begin ();
+  while (cnt > 0)
+    {
+      got = free_map_allocate_near (extent_goal (&inode->data,
+                                                 inode->sector, n),
+                                    cnt, &start);
+      if (got == 0)
+        break;
+      run_written = written;
+      for (i = 0; i < got; i++)
+        {
+          int chunk_size = DISK_SECTOR_SIZE - sector_ofs;
+          if (size - written < chunk_size)
+            chunk_size = size - written;
+          if (chunk_size < DISK_SECTOR_SIZE)
+            zero_sector (start + i);
+          write_sector (start + i, sector_ofs, (void *) (buffer + written),
+                        chunk_size);
+          written += chunk_size;
+          sector_ofs = 0;
+        }
+      if (!extent_fill (&inode->data, n, got, start))
+        {
+          free_map_release (start, got);
+          written = run_written;
           break;
         }
-        write_sector(inode->data.doubly_indirect, 4 * (i / 128), &indirect, 4);
-      }
-      write_sector(indirect, 4 * (i % 128), &tmp, 4);
-    }
-  }
-  if (i == new_nbsectors)
-    success = true;
-  else {
-    for (j = old_nbsectors; j < i; j++) {
-      read_sector(inode->data.doubly_indirect, 4 * (j / 128), &indirect, 4);
-      read_sector(indirect, 4 * (j % 128), &direct, 4);
-      free_map_release(direct, 1);
-      if (j == i - 1 || j % 128 == 127 || !(old_nbsectors % 128 > 0 && old_nbsectors / 128 == j / 128))
-        free_map_release(indirect, 1);
+      map_invalidate (inode, n, n + got);
+      *dirty = true;
+      n += got;
+      cnt -= got;
     }
-  }
-  return success;
+  free_map_end ();
+  sema_up (&inode->file_growth_sema);
+  return written;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
@@ -299,10 +1035,14 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
+  bool dirty = false;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  /* One batch covers the inode write-back below, so that sectors
+     released on the way stay allocated until it is on disk. */
+  free_map_begin ();
   sema_down(&inode->file_growth_sema);
   if (size + offset > inode->data.length) {
     // Need to grow the file
@@ -311,10 +1051,11 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     bool success = file_growth(inode, old_nbsectors, new_nbsectors);
     if (!success) {
       sema_up(&inode->file_growth_sema);
+      free_map_end ();
       return 0;
     }
     inode->data.length = size + offset;
-    write_sector(inode->sector, 0, &inode->data, DISK_SECTOR_SIZE);
+    dirty = true;
   }
   sema_up(&inode->file_growth_sema);
 
@@ -333,7 +1074,15 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       int chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
-      if (!write_sector(sector_idx, sector_ofs, buffer + bytes_written, chunk_size))
+      if (sector_idx == 0)
+        {
+          /* Fill the whole hole run the write covers at once. */
+          chunk_size = fill_block (inode, offset, buffer + bytes_written,
+                                   size, &dirty);
+          if (chunk_size == 0)
+            break;
+        }
+      else if (!write_sector(sector_idx, sector_ofs, buffer + bytes_written, chunk_size))
         break;
       
       /* Advance. */
@@ -341,6 +1090,15 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
+
+  /* Write back the grown length and any filled holes once. */
+  if (dirty)
+    {
+      sema_down (&inode->file_growth_sema);
+      write_sector (inode->sector, 0, &inode->data, DISK_SECTOR_SIZE);
+      sema_up (&inode->file_growth_sema);
+    }
+  free_map_end ();
   return bytes_written;
 }
 
@@ -349,8 +1107,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -359,9 +1119,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -2,33 +2,62 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 #include "threads/synch.h"
 
+/* A run of LENGTH consecutive disk sectors starting at START. */
+struct inode_extent
+  {
+    disk_sector_t start;                /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Number of extents stored in the inode sector itself. */
+#define INODE_INLINE_EXTENTS 61
+
 /* On-disk inode.
-   Must be exactly DISK_SECTOR_SIZE bytes long. */
+   Must be exactly DISK_SECTOR_SIZE bytes long.
+
+   MAGIC selects how file blocks map to disk sectors.  Inodes
+   with INODE_MAGIC use DOUBLY_INDIRECT as a two-level table of
+   sector pointers, and ignore the extent fields.  Inodes with
+   INODE_EXTENT_MAGIC list their data as EXTENT_CNT extents in
+   file order: the first INODE_INLINE_EXTENTS are in EXTENTS, the
+   rest in an overflow tree rooted at DOUBLY_INDIRECT (0 if
+   none). */
 struct inode_disk
   {
     int is_dir;                         /* 1 if dir. 0 if not dir */
     disk_sector_t parent;
-    disk_sector_t doubly_indirect;
+    disk_sector_t doubly_indirect;      /* Block table or extent tree. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[123];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    struct inode_extent extents[INODE_INLINE_EXTENTS];
   };
 
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open inode table. */
     disk_sector_t sector;               /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    struct lock lock;                   /* Guards the members below and,
+                                           for a directory, its entries. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
     struct semaphore file_growth_sema;
+
+    /* Cache of file block to disk sector translations, filled in
+       by byte_to_sector() a chunk at a time.  Zero entries are
+       unknown. */
+    disk_sector_t **block_map;          /* Chunk table, or null. */
+    size_t block_map_chunks;            /* Chunks allocated. */
+    struct lock block_map_lock;         /* Guards chunk allocation. */
   };
 
 struct bitmap;
@@ -40,7 +69,9 @@ struct inode *inode_reopen (struct inode *);
 disk_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+disk_sector_t inode_get_sector (struct inode *, off_t offset);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t offset, off_t size);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
@@ -0,0 +1,41 @@
+/* Child process for syn-create.
+   Creates FILE_CNT files in a directory of its own and FILE_CNT
+   files in a directory shared with the other children. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-create.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-syn-create";
+
+int
+main (int argc, const char *argv[]) 
+{
+  char dir_name[16];
+  int child_idx;
+  int i;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  snprintf (dir_name, sizeof dir_name, "/c%d", child_idx);
+  CHECK (mkdir (dir_name), "mkdir \"%s\"", dir_name);
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char file_name[32];
+
+      snprintf (file_name, sizeof file_name, "%s/f%d", dir_name, i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+
+      snprintf (file_name, sizeof file_name, "%s/%d-%d",
+                shared_dir, child_idx, i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+    }
+
+  return child_idx;
+}
@@ -0,0 +1,48 @@
+/* Writes every fourth sector of a file, leaving a hole between
+   each, so that the file has more extents than fit in its inode,
+   then fills the holes in order, one sector at a time, and
+   checks that the file reads back correctly. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define STRIDE 4
+#define DATA_CNT 100
+#define SECTOR 512
+
+static char buf[((DATA_CNT - 1) * STRIDE + 1) * SECTOR];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  size_t i;
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  msg ("write every %d sectors of \"%s\"", STRIDE, file_name);
+  for (i = 0; i < sizeof buf / SECTOR; i += STRIDE)
+    {
+      seek (fd, i * SECTOR);
+      if (write (fd, buf + i * SECTOR, SECTOR) != SECTOR)
+        fail ("write sector %zu of \"%s\" failed", i, file_name);
+    }
+
+  msg ("fill holes of \"%s\"", file_name);
+  for (i = 0; i < sizeof buf / SECTOR; i++)
+    if (i % STRIDE != 0)
+      {
+        seek (fd, i * SECTOR);
+        if (write (fd, buf + i * SECTOR, SECTOR) != SECTOR)
+          fail ("write sector %zu of \"%s\" failed", i, file_name);
+      }
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-sparse-fill) begin
+(grow-sparse-fill) create "testfile"
+(grow-sparse-fill) open "testfile"
+(grow-sparse-fill) write every 4 sectors of "testfile"
+(grow-sparse-fill) fill holes of "testfile"
+(grow-sparse-fill) close "testfile"
+(grow-sparse-fill) open "testfile" for verification
+(grow-sparse-fill) verified contents of "testfile"
+(grow-sparse-fill) close "testfile"
+(grow-sparse-fill) end
+EOF
+pass;
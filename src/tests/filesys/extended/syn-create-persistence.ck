@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($tree) = {"child-syn-create" => "tests/filesys/extended/child-syn-create"};
+for my $child (0...3) {
+    for my $i (0...19) {
+	$tree->{"c$child"}{"f$i"} = [''];
+	$tree->{"shared"}{"$child-$i"} = [''];
+    }
+}
+check_archive ($tree);
+pass;
@@ -0,0 +1,52 @@
+/* Runs several subprocesses that each create many files at the
+   same time, some in a directory private to the child and some
+   in a directory that all of them share, then checks that every
+   file was created exactly once. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-create.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  char name[READDIR_MAX_LEN + 1];
+  int child, i, entry_cnt;
+  int fd;
+
+  CHECK (mkdir (shared_dir), "mkdir \"%s\"", shared_dir);
+
+  exec_children ("child-syn-create", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+
+  quiet = true;
+  for (child = 0; child < CHILD_CNT; child++)
+    for (i = 0; i < FILE_CNT; i++)
+      {
+        char file_name[32];
+
+        snprintf (file_name, sizeof file_name, "/c%d/f%d", child, i);
+        CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+        close (fd);
+
+        snprintf (file_name, sizeof file_name, "%s/%d-%d",
+                  shared_dir, child, i);
+        CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+        close (fd);
+      }
+  quiet = false;
+  msg ("open all files");
+
+  CHECK ((fd = open (shared_dir)) > 1, "open \"%s\"", shared_dir);
+  entry_cnt = 0;
+  while (readdir (fd, name))
+    entry_cnt++;
+  close (fd);
+  if (entry_cnt != CHILD_CNT * FILE_CNT)
+    fail ("\"%s\" has %d entries, expected %d",
+          shared_dir, entry_cnt, CHILD_CNT * FILE_CNT);
+  msg ("\"%s\" has %d entries", shared_dir, entry_cnt);
+}
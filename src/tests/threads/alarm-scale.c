@@ -0,0 +1,88 @@
+/* Checks that the work the timer interrupt does on alarms grows
+   with the number of alarms, not with the number of alarms
+   pending at each tick.
+
+   Sets ALARM_CNT alarms spread over the next ALARM_SPAN ticks,
+   long enough that some have to cascade down the timing wheel,
+   and sleeps until all of them have fired.  Counts the alarms
+   the timing wheel moved or fired meanwhile, which does not
+   depend on the speed of the machine or the simulator, and fails
+   if that is more than a few per alarm.  Scanning the pending
+   alarms at every tick would take about ALARM_CNT * ALARM_SPAN / 2.
+   Also checks that every alarm fired on exactly its scheduled
+   tick. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of alarms. */
+#define ALARM_CNT 10000
+
+/* Alarms are spread over this many ticks. */
+#define ALARM_SPAN 500
+
+/* Most wheel operations allowed per alarm: it is moved at most
+   once for each level of the wheel above the lowest, then fired.
+   Four covers a wheel with up to three upper levels. */
+#define MAX_OPS_PER_ALARM 4
+
+/* Slack for alarms set by other threads meanwhile. */
+#define SLACK_OPS 100
+
+static timer_alarm_func alarm_func;
+
+/* Number of alarms that fired, and of those that fired on the
+   wrong tick. */
+static int fired_cnt;
+static int late_cnt;
+
+void
+test_alarm_scale (void) 
+{
+  struct timer_alarm *alarms;
+  long long ops;
+  int64_t start;
+  int i;
+
+  alarms = malloc (sizeof *alarms * ALARM_CNT);
+  if (alarms == NULL)
+    fail ("couldn't allocate alarms");
+
+  msg ("Setting %d alarms over %d ticks.", ALARM_CNT, ALARM_SPAN);
+  ops = timer_wheel_ops ();
+  start = timer_ticks ();
+  for (i = 0; i < ALARM_CNT; i++) 
+    {
+      timer_alarm_init (&alarms[i], alarm_func, NULL);
+      if (!timer_alarm_set (&alarms[i],
+                            start + 1 + (int64_t) i * 7919 % ALARM_SPAN))
+        fail ("alarm %d could not be set", i);
+    }
+
+  msg ("Sleeping until all of them have fired.");
+  timer_sleep (start + ALARM_SPAN + 1 - timer_ticks ());
+  ops = timer_wheel_ops () - ops;
+  free (alarms);
+
+  if (fired_cnt != ALARM_CNT)
+    fail ("only %d of %d alarms fired", fired_cnt, ALARM_CNT);
+  if (late_cnt != 0)
+    fail ("%d of %d alarms fired on the wrong tick", late_cnt, fired_cnt);
+  if (ops > (long long) MAX_OPS_PER_ALARM * ALARM_CNT + SLACK_OPS)
+    fail ("timing wheel did %lld operations for %d alarms",
+          ops, ALARM_CNT);
+  msg ("Timer work did not grow with the number of pending alarms.");
+}
+
+/* Alarm function: checks that the alarm fired on time. */
+static void
+alarm_func (struct timer_alarm *alarm) 
+{
+  fired_cnt++;
+  if (alarm->wakeup_time != timer_ticks ())
+    late_cnt++;
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-scale) begin
+(alarm-scale) Setting 10000 alarms over 500 ticks.
+(alarm-scale) Sleeping until all of them have fired.
+(alarm-scale) Timer work did not grow with the number of pending alarms.
+(alarm-scale) end
+EOF
+pass;
@@ -0,0 +1,104 @@
+/* Checks that the cost of a context switch does not depend on
+   the number of threads on the run queue.
+
+   For each of several run queue sizes, creates that many
+   low-priority threads, which stay ready but never get to run,
+   and then measures how long two default-priority threads take
+   to yield to each other a fixed number of times.  Fails if the
+   switches with the largest run queue take much longer than
+   with the smallest one. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of times each of the two threads yields per round. */
+#define YIELD_CNT 20000
+
+/* Slack, in timer ticks, allowed on top of doubling the cost of
+   the smallest round, to absorb timer granularity. */
+#define SLACK_TICKS 2
+
+static thread_func filler_func;
+static thread_func yielder_func;
+static int64_t measure_switches (int filler_cnt);
+
+void
+test_priority_scale (void) 
+{
+  static const int filler_cnts[] = {1, 32, 128};
+  const int round_cnt = sizeof filler_cnts / sizeof *filler_cnts;
+  int64_t cost[sizeof filler_cnts / sizeof *filler_cnts];
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  for (i = 0; i < round_cnt; i++) 
+    {
+      msg ("Measuring %d switches with %d ready threads.",
+           2 * YIELD_CNT, filler_cnts[i]);
+      cost[i] = measure_switches (filler_cnts[i]);
+    }
+
+  if (cost[round_cnt - 1] > 2 * cost[0] + SLACK_TICKS)
+    fail ("switches took %lld ticks with %d ready threads "
+          "but only %lld ticks with %d",
+          cost[round_cnt - 1], filler_cnts[round_cnt - 1],
+          cost[0], filler_cnts[0]);
+  msg ("Switch cost did not grow with the number of ready threads.");
+}
+
+/* Creates FILLER_CNT ready threads below the default priority,
+   times YIELD_CNT round trips between this thread and another
+   default-priority thread, then lets the fillers run to
+   completion.  Returns the number of ticks the round trips
+   took. */
+static int64_t
+measure_switches (int filler_cnt) 
+{
+  struct semaphore done;
+  int64_t start, elapsed;
+  int i;
+
+  for (i = 0; i < filler_cnt; i++) 
+    if (thread_create ("filler", PRI_DEFAULT - 1, filler_func, NULL)
+        == TID_ERROR)
+      fail ("could not create filler thread %d", i);
+
+  sema_init (&done, 0);
+  start = timer_ticks ();
+  thread_create ("yielder", PRI_DEFAULT, yielder_func, &done);
+  for (i = 0; i < YIELD_CNT; i++)
+    thread_yield ();
+  sema_down (&done);
+  elapsed = timer_elapsed (start);
+
+  /* Let the fillers run and exit. */
+  thread_set_priority (PRI_MIN);
+  thread_set_priority (PRI_DEFAULT);
+
+  return elapsed;
+}
+
+static void
+filler_func (void *aux UNUSED) 
+{
+}
+
+static void
+yielder_func (void *done_) 
+{
+  struct semaphore *done = done_;
+  int i;
+
+  for (i = 0; i < YIELD_CNT; i++)
+    thread_yield ();
+  sema_up (done);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(priority-scale) begin
+(priority-scale) Measuring 40000 switches with 1 ready threads.
+(priority-scale) Measuring 40000 switches with 32 ready threads.
+(priority-scale) Measuring 40000 switches with 128 ready threads.
+(priority-scale) Switch cost did not grow with the number of ready threads.
+(priority-scale) end
+EOF
+pass;
@@ -0,0 +1,59 @@
+/* Opens many file descriptors at once, checks that open() always
+   returns the lowest free file descriptor, so that closed
+   descriptors get reused, and checks that seek() and tell() reach
+   the right file through every one of them. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Number of file descriptors held open. */
+#define FD_CNT 256
+
+/* Number of passes of seek() and tell() over every fd. */
+#define ROUNDS 4
+
+static int fds[FD_CNT];
+
+void
+test_main (void) 
+{
+  int size = sizeof sample - 1;
+  int i, round;
+
+  msg ("open \"sample.txt\" %d times", FD_CNT);
+  for (i = 0; i < FD_CNT; i++)
+    {
+      fds[i] = open ("sample.txt");
+      if (fds[i] < 2)
+        fail ("open #%d returned %d", i, fds[i]);
+      if (i > 0 && fds[i] != fds[i - 1] + 1)
+        fail ("open #%d returned %d, expected %d", i, fds[i], fds[i - 1] + 1);
+    }
+
+  msg ("close every other fd and reopen");
+  for (i = 0; i < FD_CNT; i += 2)
+    close (fds[i]);
+  for (i = 0; i < FD_CNT; i += 2)
+    {
+      int fd = open ("sample.txt");
+      if (fd != fds[i])
+        fail ("reopen returned %d, expected lowest free fd %d", fd, fds[i]);
+    }
+
+  msg ("seek and tell %d times", ROUNDS * FD_CNT);
+  for (round = 0; round < ROUNDS; round++)
+    for (i = 0; i < FD_CNT; i++)
+      {
+        unsigned pos = (round + i) % size;
+        seek (fds[i], pos);
+        if (tell (fds[i]) != pos)
+          fail ("tell(%d) returned %u, expected %u",
+                fds[i], tell (fds[i]), pos);
+      }
+
+  msg ("close %d fds", FD_CNT);
+  for (i = 0; i < FD_CNT; i++)
+    close (fds[i]);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(open-many) begin
+(open-many) open "sample.txt" 256 times
+(open-many) close every other fd and reopen
+(open-many) seek and tell 1024 times
+(open-many) close 256 fds
+(open-many) end
+open-many: exit(0)
+EOF
+pass;
@@ -0,0 +1,42 @@
+/* Fills a 128 kB array, forks, and has the child check and then
+   overwrite it.  The child must see the parent's data, and the
+   parent's copy must be unchanged after the child exits. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/cksum.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (128 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  struct arc4 arc4;
+  unsigned long sum;
+  pid_t child;
+
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, buf, SIZE);
+  sum = cksum (buf, SIZE);
+
+  child = fork ();
+  if (child == 0) 
+    {
+      if (cksum (buf, SIZE) != sum)
+        fail ("child sees different data");
+      memset (buf, 0, SIZE);
+      exit (81);
+    }
+  if (child == -1)
+    fail ("fork failed");
+
+  CHECK (wait (child) == 81, "wait for child");
+  if (cksum (buf, SIZE) != sum)
+    fail ("child's writes changed parent's data");
+  msg ("parent's data intact");
+}
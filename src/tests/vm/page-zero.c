@@ -0,0 +1,52 @@
+/* Reads all of a 2 MB BSS array, which must be zero, then writes
+   one byte in every eighth page and verifies that the written
+   pages, and only those, changed.  Also writes to a file with
+   write() from a page that has only ever been read and from one
+   that has never been touched at all, both of which the kernel
+   reads through the zero page, and checks the file's contents. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+#define PAGE 4096
+
+static char buf[SIZE];
+static char untouched[2 * PAGE];   /* Holds one whole page. */
+
+void
+test_main (void)
+{
+  char *fresh = (char *) (((uintptr_t) untouched + PAGE - 1) & ~(PAGE - 1));
+  size_t i;
+  int handle;
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu != 0", i);
+
+  msg ("write pass");
+  for (i = 0; i < SIZE; i += 8 * PAGE)
+    buf[i + 1] = 0x5a;
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (i % (8 * PAGE) == 1 ? 0x5a : 0))
+      fail ("byte %zu has wrong value", i);
+
+  CHECK (create ("zeros", PAGE), "create \"zeros\"");
+  CHECK ((handle = open ("zeros")) > 1, "open \"zeros\"");
+  CHECK (write (handle, buf + 3 * PAGE, PAGE) == PAGE,
+         "write \"zeros\" from read-only page");
+  seek (handle, 0);
+  CHECK (write (handle, fresh, PAGE) == PAGE,
+         "write \"zeros\" from untouched page");
+  msg ("close \"zeros\"");
+  close (handle);
+
+  check_file ("zeros", buf + 5 * PAGE, PAGE);
+}
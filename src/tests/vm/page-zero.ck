@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-zero) begin
+(page-zero) read pass
+(page-zero) write pass
+(page-zero) read pass
+(page-zero) create "zeros"
+(page-zero) open "zeros"
+(page-zero) write "zeros" from read-only page
+(page-zero) write "zeros" from untouched page
+(page-zero) close "zeros"
+(page-zero) open "zeros" for verification
+(page-zero) verified contents of "zeros"
+(page-zero) close "zeros"
+(page-zero) end
+EOF
+pass;
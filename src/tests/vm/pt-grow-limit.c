@@ -0,0 +1,27 @@
+/* Grows the stack one page at a time until it reaches twice the
+   default 1 MB limit on stack size.  The process must be
+   terminated with -1 exit code before it gets there. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define LIMIT (2 * 1024 * 1024)
+
+static void
+grow (size_t depth) 
+{
+  volatile char page[4096];
+
+  page[0] = depth;
+  if (depth * sizeof page < LIMIT)
+    grow (depth + 1);
+  page[sizeof page - 1] = page[0];
+}
+
+void
+test_main (void)
+{
+  grow (0);
+  fail ("stack grew past %d bytes", LIMIT);
+}
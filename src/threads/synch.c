@@ -203,7 +203,7 @@ void donate(struct thread *t, int level){
   if(t->waiting_lock==NULL)
     return;
   if(t->priority > t->waiting_lock->holder->priority){
-    t->waiting_lock->holder->priority = t->priority;
+    thread_update_priority(t->waiting_lock->holder, t->priority);
     donate(t->waiting_lock->holder, level+1);
   }
 }
@@ -225,7 +225,7 @@ lock_acquire (struct lock *lock)
   ASSERT (!lock_held_by_current_thread (lock));
   
   enum intr_level old_level = intr_disable();
-  if(lock->holder!=NULL){//someone is holding a lock
+  if(lock->holder!=NULL && !thread_mlfqs){//someone is holding a lock
     thread_current()->waiting_lock = lock;
     donate(thread_current(), 0);
   }
@@ -276,9 +276,11 @@ lock_release (struct lock *lock)
   enum intr_level old_level = intr_disable();
   lock->holder = NULL;
   list_remove(&lock->elem);
-  int max_donated_priority = get_max_donated_priority();
-  int assigned_priority = thread_current()->assigned_priority;
-  thread_current()->priority = max_donated_priority >  assigned_priority ? max_donated_priority : assigned_priority;
+  if (!thread_mlfqs) {
+    int max_donated_priority = get_max_donated_priority();
+    int assigned_priority = thread_current()->assigned_priority;
+    thread_current()->priority = max_donated_priority >  assigned_priority ? max_donated_priority : assigned_priority;
+  }
   intr_set_level(old_level);
 
   sema_up (&lock->semaphore); 
@@ -2,8 +2,10 @@
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -25,9 +27,16 @@
    Do not modify this value. */
 #define THREAD_BASIC 0xd42df210
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queue of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO list per priority level, and READY_MASK has
+   bit N set in word N / 32 if and only if ready_queues[N] is
+   non-empty, so that both enqueueing a thread and finding the
+   highest-priority ready thread take constant time. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+static struct list ready_queues[PRI_CNT];
+static uint32_t ready_mask[DIV_ROUND_UP (PRI_CNT, 32)];
+static int ready_cnt;           /* # of threads on the run queue. */
 
 /* Idle thread. */
 static struct thread *idle_thread;
@@ -60,6 +69,15 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* MLFQS state.  Only threads whose recent_cpu or nice is nonzero
+   are on CPU_LIST, since the once-per-second decay cannot change
+   anyone else's priority.  STALE_LIST holds the threads that
+   have run since priorities were last recomputed, which are the
+   only ones whose recent_cpu changed in the meantime. */
+static fixed_t load_avg;        /* System load average. */
+static struct list cpu_list;    /* Threads with nonzero recent_cpu or nice. */
+static struct list stale_list;  /* Threads that ran in this time slice. */
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -71,6 +89,13 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static int ready_max_priority (void);
+static void mlfqs_tick (struct thread *);
+static void mlfqs_update_priority (struct thread *);
+static void mlfqs_track (struct thread *);
+static void mlfqs_untrack (struct thread *);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -91,16 +116,23 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
+  list_init (&cpu_list);
+  list_init (&stale_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  if (thread_mlfqs)
+    mlfqs_update_priority (initial_thread);
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -137,11 +169,31 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (++thread_ticks >= TIME_SLICE
+      || (thread_mlfqs && t->priority < ready_max_priority ()))
     intr_yield_on_return ();
 }
 
+/* Called by the timer, in the idle thread with interrupts off,
+   for each tick that tickless idle let pass without an interrupt.
+   Does the bookkeeping of thread_tick() but not its preemption,
+   which is only possible from the timer interrupt.  The idle
+   thread gives up the CPU right afterward anyway. */
+void
+thread_idle_tick (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (thread_current () == idle_thread);
+
+  idle_ticks++;
+  if (thread_mlfqs)
+    mlfqs_tick (idle_thread);
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
@@ -182,9 +234,20 @@ thread_create (const char *name, int priority,
   if (t == NULL)
     return TID_ERROR;
 
-  /* Initialize thread. */
+  /* Initialize thread.  Under the MLFQS, the new thread inherits
+     its creator's nice and recent_cpu, and PRIORITY is ignored
+     except for the idle thread. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+  if (thread_mlfqs && function != idle)
+    {
+      enum intr_level old_level = intr_disable ();
+      t->nice = thread_current ()->nice;
+      t->recent_cpu = thread_current ()->recent_cpu;
+      mlfqs_update_priority (t);
+      mlfqs_track (t);
+      intr_set_level (old_level);
+    }
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
@@ -202,7 +265,7 @@ thread_create (const char *name, int priority,
 
   /* Add to run queue. */
   thread_unblock (t);
-  if(priority > thread_current()->priority){
+  if(t->priority > thread_current()->priority){
     thread_yield();
   }
 
@@ -242,7 +305,7 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  ready_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
 }
@@ -294,6 +357,8 @@ thread_exit (void)
   /* Just set our status to dying and schedule another process.
      We will be destroyed during the call to schedule_tail(). */
   intr_disable ();
+  if (thread_mlfqs)
+    mlfqs_untrack (thread_current ());
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -311,7 +376,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (curr != idle_thread) 
-    list_push_back (&ready_list, &curr->elem);
+    ready_push (curr);
   curr->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -341,6 +406,11 @@ void
 thread_set_priority (int new_priority) 
 {
   bool should_yield = false;
+
+  /* The MLFQS computes priorities itself. */
+  if (thread_mlfqs)
+    return;
+
   // thread_current ()->priority = new_priority;
   thread_current()->assigned_priority = new_priority;
   if(new_priority > thread_current()->priority)
@@ -351,18 +421,7 @@ thread_set_priority (int new_priority)
   thread_current()->priority = max_donated_priority > new_priority ? max_donated_priority : new_priority;
   enum intr_level old_level = intr_disable();
 
-  struct list_elem *e;
-  int max_priority =-1;
-  struct thread *max_priority_thread;
-  for (e = list_begin (&ready_list); e != list_end (&ready_list); e = list_next (e)){
-    struct thread *t = list_entry(e, struct thread, elem);
-    if(t->priority > max_priority){
-      max_priority = t->priority;
-      max_priority_thread = t;
-    }
-  } 
-
-  if(thread_current()->priority < max_priority){
+  if(thread_current()->priority < ready_max_priority()){
     should_yield = true;
   }
 
@@ -371,6 +430,29 @@ thread_set_priority (int new_priority)
     thread_yield();
 }
 
+/* Sets thread T's effective priority to PRIORITY, e.g. because
+   a higher-priority thread donated to it.  If T is on the run
+   queue, it is moved to the queue for its new priority. */
+void
+thread_update_priority (struct thread *t, int priority)
+{
+  enum intr_level old_level;
+
+  ASSERT (is_thread (t));
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  old_level = intr_disable ();
+  if (t->status == THREAD_READY && t->priority != priority)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
+  intr_set_level (old_level);
+}
+
 /* Returns the current thread's priority. */
 int
 thread_get_priority (void) 
@@ -378,37 +460,167 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest
+   priority. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *curr = thread_current ();
+  enum intr_level old_level;
+  bool should_yield;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  curr->nice = nice;
+  mlfqs_update_priority (curr);
+  mlfqs_track (curr);
+  should_yield = curr->priority < ready_max_priority ();
+  intr_set_level (old_level);
+
+  if (should_yield)
+    thread_yield ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load_avg_100 = fp_round (load_avg * 100);
+  intr_set_level (old_level);
+  return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent_cpu_100 = fp_round (thread_current ()->recent_cpu * 100);
+  intr_set_level (old_level);
+  return recent_cpu_100;
 }
-
+
+/* MLFQS bookkeeping for one timer tick, during which T was
+   running.  Charges the tick to T, then once per second updates
+   load_avg and decays every tracked thread's recent_cpu, and
+   otherwise every TIME_SLICE ticks recomputes the priorities of
+   just the threads that have run in the meantime.  Interrupts
+   must be off. */
+static void
+mlfqs_tick (struct thread *t) 
+{
+  int64_t now = timer_ticks ();
+
+  if (t != idle_thread)
+    {
+      t->recent_cpu = fp_add_int (t->recent_cpu, 1);
+      mlfqs_track (t);
+      if (!t->cpu_stale)
+        {
+          t->cpu_stale = true;
+          list_push_back (&stale_list, &t->stale_elem);
+        }
+    }
+
+  if (now % TIMER_FREQ == 0)
+    {
+      int ready_threads = ready_cnt + (t != idle_thread);
+      fixed_t decay;
+      struct list_elem *e;
+
+      load_avg = (fp_mul (fp_div (fp_from_int (59), fp_from_int (60)),
+                          load_avg)
+                  + fp_from_int (ready_threads) / 60);
+      decay = fp_div (2 * load_avg, fp_add_int (2 * load_avg, 1));
+
+      /* Every thread whose recent_cpu is about to change is on
+         cpu_list, so the stale threads are covered too. */
+      while (!list_empty (&stale_list))
+        list_entry (list_pop_front (&stale_list),
+                    struct thread, stale_elem)->cpu_stale = false;
+
+      for (e = list_begin (&cpu_list); e != list_end (&cpu_list); )
+        {
+          struct thread *u = list_entry (e, struct thread, cpu_elem);
+          e = list_next (e);
+
+          u->recent_cpu = fp_add_int (fp_mul (decay, u->recent_cpu), u->nice);
+          mlfqs_update_priority (u);
+          mlfqs_track (u);
+        }
+    }
+  else if (now % TIME_SLICE == 0)
+    while (!list_empty (&stale_list))
+      {
+        struct thread *u = list_entry (list_pop_front (&stale_list),
+                                       struct thread, stale_elem);
+        u->cpu_stale = false;
+        mlfqs_update_priority (u);
+      }
+}
+
+/* Recomputes T's priority from its recent_cpu and nice values
+   and moves it to the matching run queue.  Interrupts must be
+   off. */
+static void
+mlfqs_update_priority (struct thread *t) 
+{
+  int priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t == idle_thread)
+    return;
+
+  priority = PRI_MAX - fp_trunc (t->recent_cpu / 4) - t->nice * 2;
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  t->assigned_priority = priority;
+  thread_update_priority (t, priority);
+}
+
+/* Adds T to cpu_list if its recent_cpu or nice is nonzero, and
+   removes it otherwise.  Interrupts must be off. */
+static void
+mlfqs_track (struct thread *t) 
+{
+  bool active = t->recent_cpu != 0 || t->nice != 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (active && !t->cpu_active)
+    list_push_back (&cpu_list, &t->cpu_elem);
+  else if (!active && t->cpu_active)
+    list_remove (&t->cpu_elem);
+  t->cpu_active = active;
+}
+
+/* Removes T from all MLFQS lists, because it is exiting.
+   Interrupts must be off. */
+static void
+mlfqs_untrack (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->cpu_active)
+    list_remove (&t->cpu_elem);
+  if (t->cpu_stale)
+    list_remove (&t->stale_elem);
+  t->cpu_active = t->cpu_stale = false;
+}
+
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
@@ -429,7 +641,9 @@ idle (void *idle_started_ UNUSED)
     {
       /* Let someone else run. */
       intr_disable ();
+      timer_idle_exit ();
       thread_block ();
+      timer_idle_enter ();
 
       /* Re-enable interrupts and wait for the next one.
 
@@ -494,9 +708,14 @@ init_thread (struct thread *t, const char *name, int priority)
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
   t->assigned_priority = priority;
+  t->nice = NICE_DEFAULT;
+  t->recent_cpu = 0;
   t->magic = THREAD_MAGIC;
   list_init(&t->acquired_locks);
   t->waiting_lock = NULL;
+#ifdef VM
+  list_init (&t->mappings);
+#endif
 }
 
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
@@ -520,24 +739,58 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int priority = ready_max_priority ();
+  struct thread *t;
+
+  if (priority < PRI_MIN)
     return idle_thread;
-  else{
-    struct list_elem *e;
-    int max_priority =-1;
-    struct thread *max_priority_thread;
-    for (e = list_begin (&ready_list); e != list_end (&ready_list); e = list_next (e)){
-      struct thread *t = list_entry(e, struct thread, elem);
-      if(t->priority > max_priority){
-        max_priority = t->priority;
-        max_priority_thread = t;
-      }
-    }
-    list_remove(&max_priority_thread->elem);
-     return max_priority_thread;
-  }
-    
+
+  t = list_entry (list_front (&ready_queues[priority - PRI_MIN]),
+                  struct thread, elem);
+  ready_remove (t);
+  return t;
+}
+
+/* Adds T to the back of the run queue for its priority. */
+static void
+ready_push (struct thread *t) 
+{
+  int i = t->priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_back (&ready_queues[i], &t->elem);
+  ready_mask[i / 32] |= 1u << (i % 32);
+  ready_cnt++;
 }
+
+/* Removes T from the run queue for its priority. */
+static void
+ready_remove (struct thread *t) 
+{
+  int i = t->priority - PRI_MIN;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[i]))
+    ready_mask[i / 32] &= ~(1u << (i % 32));
+  ready_cnt--;
+}
+
+/* Returns the highest priority of any thread on the run queue,
+   or PRI_MIN - 1 if the run queue is empty. */
+static int
+ready_max_priority (void) 
+{
+  int w;
+
+  for (w = (int) (sizeof ready_mask / sizeof *ready_mask) - 1; w >= 0; w--)
+    if (ready_mask[w] != 0)
+      return PRI_MIN + w * 32 + (31 - __builtin_clz (ready_mask[w]));
+  return PRI_MIN - 1;
+}
+
 /* Completes a thread switch by activating the new thread's page
    tables, and, if the previous thread is dying, destroying it.
 
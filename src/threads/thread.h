@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 #include "threads/synch.h"
 #include "filesys/directory.h"
 
@@ -26,6 +27,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the MLFQS. */
+#define NICE_MIN -20                    /* Nicest. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -92,13 +98,17 @@ struct thread
     int priority;                       /* Priority. */
     int assigned_priority;
 
-    struct list_elem sleeping_elem;
-    struct semaphore sleeping_sema;
-    int64_t wakeup_time;
-
     struct lock *waiting_lock;
     struct list acquired_locks;
 
+    /* Owned by thread.c, used only by the MLFQS. */
+    int nice;                           /* Niceness, -20 to 20. */
+    fixed_t recent_cpu;                 /* Recent CPU time received. */
+    bool cpu_active;                    /* In cpu_list? */
+    struct list_elem cpu_elem;          /* Element in cpu_list. */
+    bool cpu_stale;                     /* In stale_list? */
+    struct list_elem stale_elem;        /* Element in stale_list. */
+
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
 
@@ -107,6 +117,25 @@ struct thread
     uint32_t *pagedir;                  /* Page directory. */
     int exit_status;
     struct dir * cur_dir;
+
+    /* Owned by userprog/syscall.c. */
+    struct open_info *fds;              /* File descriptor table. */
+    int fd_cnt;                         /* Number of entries in fds. */
+    int fd_free;                        /* No fd below this is free. */
+#endif
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash *pages;                 /* Page table. */
+    struct file *bin_file;              /* Executable, kept open. */
+    void *user_esp;                     /* User esp on kernel entry. */
+
+    /* Owned by userprog/syscall.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Next mapping id to hand out. */
+#endif
+#ifdef FILESYS
+    /* Owned by filesys/free-map.c. */
+    int free_map_batch;                 /* Nesting depth of batches. */
 #endif
 
     /* Owned by thread.c. */
@@ -122,6 +151,7 @@ void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_idle_tick (void);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -139,6 +169,7 @@ void thread_yield (void);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_update_priority (struct thread *, int);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -2,8 +2,13 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/syscall.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -89,7 +94,7 @@ kill (struct intr_frame *f)
       printf ("%s: dying due to interrupt %#04x (%s).\n",
               thread_name (), f->vec_no, intr_name (f->vec_no));
       intr_dump_frame (f);
-      exit(-1); 
+      terminate_process (); 
 
     case SEL_KCSEG:
       /* Kernel's code segment, which indicates a kernel bug.
@@ -104,7 +109,7 @@ kill (struct intr_frame *f)
          kernel. */
       printf ("Interrupt %#04x (%s) in unknown segment %04x\n",
              f->vec_no, intr_name (f->vec_no), f->cs);
-      exit(-1);
+      terminate_process ();
     }
 }
 
@@ -147,10 +152,33 @@ page_fault (struct intr_frame *f)
   not_present = (f->error_code & PF_P) == 0;
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
+
+#ifdef VM
+  /* Bring in the page, if the address is part of the process's
+     address space or just below the user stack.  A fault taken
+     in user mode carries the user esp; for a kernel fault, the
+     system call handler saved it on entry. */
+  if (user)
+    thread_current ()->user_esp = f->esp;
+  if (not_present && page_in (fault_addr, write))
+    return;
+
+  /* A write to a page shared copy-on-write. */
+  if (!not_present && write && page_copy_on_write (fault_addr))
+    return;
+#endif
     
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+  /* A kernel fault on a user address comes from one of the user
+     memory accessors in userprog/syscall.c, which leave the
+     address to resume at in eax.  Resume there with eax set to
+     -1, so that the accessor reports the failure. */
+  if (!user && is_user_vaddr (fault_addr))
+    {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = 0xffffffff;
+      return;
+    }
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
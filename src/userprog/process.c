@@ -8,6 +8,7 @@
 #include <list.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -20,6 +21,9 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 struct exit_info {
   tid_t tid;
@@ -42,10 +46,23 @@ struct pack {
   struct dir * dir;
 };
 
+#ifdef VM
+/* Passed from process_fork() to start_fork(). */
+struct fork_info {
+  struct thread * parent;
+  struct intr_frame if_;        /* Parent's user registers. */
+  struct semaphore sema;        /* Upped once the child is set up. */
+  bool success;
+};
+#endif
+
 static struct list exit_info_list;
 static struct list relationship_list;
 
 static thread_func start_process NO_RETURN;
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+#endif
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
 void process_init() {
@@ -118,7 +135,7 @@ start_process (void * aux)
   if (!success) {
     palloc_free_page(argv);
     sema_up(sema);
-    exit(-1);
+    terminate_process ();
   }
 
   /* Put the arguments on the stack */
@@ -163,6 +180,87 @@ start_process (void * aux)
   NOT_REACHED ();
 }
 
+#ifdef VM
+/* Starts a copy of the current process, which entered the kernel
+   through the system call frame PARENT_IF.  The copy shares the
+   current process's memory copy-on-write and its open files, and
+   returns 0 from the system call.  Returns the new process's
+   thread id, or TID_ERROR if it cannot be created. */
+tid_t
+process_fork (const struct intr_frame *parent_if)
+{
+  struct fork_info info;
+  tid_t tid;
+
+  info.parent = thread_current ();
+  info.if_ = *parent_if;
+  info.success = false;
+  sema_init (&info.sema, 0);
+  tid = thread_create (thread_current ()->name, PRI_DEFAULT, start_fork,
+                       &info);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  /* The child reads our page table, so we must not run until it
+     is done. */
+  sema_down (&info.sema);
+  return info.success ? tid : TID_ERROR;
+}
+
+/* A thread function that clones the process described by AUX, a
+   struct fork_info, and starts running it. */
+static void
+start_fork (void *aux)
+{
+  struct fork_info *info = aux;
+  struct thread *parent = info->parent;
+  struct thread *t = thread_current ();
+  struct intr_frame if_ = info->if_;
+  struct relationship_info *new_info;
+
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    goto fail;
+  process_activate ();
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    goto fail;
+  hash_init (t->pages, page_hash, page_less, NULL);
+
+  t->bin_file = file_reopen (parent->bin_file);
+  if (t->bin_file == NULL)
+    goto fail;
+  file_deny_write (t->bin_file);
+
+  new_info = malloc (sizeof *new_info);
+  if (new_info == NULL
+      || !page_fork (parent)
+      || !syscall_inherit_fds (parent))
+    {
+      free (new_info);
+      goto fail;
+    }
+  t->cur_dir = dir_reopen (parent->cur_dir);
+  new_info->parent_tid = parent->tid;
+  new_info->child_tid = t->tid;
+  sema_init (&new_info->sema, 0);
+  list_push_back (&relationship_list, &new_info->elem);
+
+  info->success = true;
+  sema_up (&info->sema);
+
+  /* Return to user mode where the parent entered the kernel, with
+     fork() returning 0. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+
+ fail:
+  sema_up (&info->sema);
+  terminate_process ();
+}
+#endif
+
 /* This is 2016 spring cs330 skeleton code */
 
 /* Waits for thread TID to die and returns its exit status.  If
@@ -212,10 +310,20 @@ process_wait (tid_t child_tid UNUSED)
 void
 process_exit (void)
 {
-  enum intr_level old_level = intr_disable();
   struct thread *curr = thread_current ();
+  enum intr_level old_level;
   uint32_t *pd;
 
+#ifdef VM
+  /* Release the process's frames and swap slots.  This may
+     block, so it must happen before interrupts are turned off. */
+  page_exit ();
+  file_close (curr->bin_file);
+  curr->bin_file = NULL;
+#endif
+
+  old_level = intr_disable ();
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = curr->pagedir;
@@ -376,6 +484,12 @@ load (const char *file_name, void (**eip) (void), void **esp)
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
+#ifdef VM
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    goto done;
+  hash_init (t->pages, page_hash, page_less, NULL);
+#endif
 
   /* Open executable file. */
   file = filesys_open (file_name);
@@ -384,6 +498,11 @@ load (const char *file_name, void (**eip) (void), void **esp)
       printf ("load: %s: open failed\n", file_name);
       goto done; 
     }
+#ifdef VM
+  /* Pages are read from the executable on demand, so it has to
+     stay open and unmodified for the life of the process. */
+  file_deny_write (file);
+#endif
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -468,13 +587,22 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
  done:
   /* We arrive here whether the load is successful or not. */
+#ifdef VM
+  if (success)
+    t->bin_file = file;
+  else
+    file_close (file);
+#else
   file_close (file);
+#endif
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -535,6 +663,54 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
 
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
+#ifdef VM
+static bool
+load_segment (struct file *file, off_t ofs, uint8_t *upage,
+              uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
+{
+  ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (ofs % PGSIZE == 0);
+
+  while (read_bytes > 0 || zero_bytes > 0) 
+    {
+      /* Nothing is read here: each page only records where its
+         contents come from and is filled in by page_in() on the
+         first fault. */
+      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+      size_t page_zero_bytes = PGSIZE - page_read_bytes;
+      struct page *p = page_allocate (upage, !writable);
+      if (p == NULL)
+        return false;
+      if (page_read_bytes > 0) 
+        {
+          p->file = file;
+          p->file_offset = ofs;
+          p->file_bytes = page_read_bytes;
+        }
+
+      /* Advance. */
+      read_bytes -= page_read_bytes;
+      zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
+      upage += PGSIZE;
+    }
+  return true;
+}
+
+/* Create a minimal stack by mapping a zeroed page at the top of
+   user virtual memory. */
+static bool
+setup_stack (void **esp) 
+{
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+  struct page *p = page_allocate (upage, false);
+  if (p == NULL || !page_in (upage, true))
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+}
+#else /* !VM */
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
@@ -619,3 +795,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif /* !VM */
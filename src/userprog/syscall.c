@@ -1,7 +1,10 @@
 #include "userprog/process.h"
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "devices/timer.h"
+#include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/synch.h"
@@ -13,153 +16,412 @@
 #include "filesys/directory.h"
 #include "filesys/inode.h"
 #include "list.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
+/* An entry in a process's file descriptor table.  At most one
+   of FILE_PTR and DIR_PTR is nonnull; if both are null, the fd
+   is free. */
 struct open_info {
-  int fd;
-  tid_t tid;
   struct file * file_ptr;
   struct dir * dir_ptr;
-  struct list_elem elem;
 };
 
-static struct list open_info_list;
-
-struct lock fd_lock;
+/* Lowest fd handed out; 0 and 1 are the console. */
+#define FD_MIN 2
 
-struct semaphore filesys_sema;
+/* Initial number of entries in a file descriptor table. */
+#define FD_TABLE_MIN 16
 
 static void syscall_handler (struct intr_frame *);
 
 void
 syscall_init (void) 
 {
-  lock_init(&fd_lock);
-  list_init(&open_info_list);
-  sema_init(&filesys_sema, 1);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* Returns the current process's table entry for FD, or a null
+   pointer if FD is not open. */
+static struct open_info *
+get_open_info (int fd)
+{
+  struct thread * t = thread_current();
+  if (fd < FD_MIN || fd >= t->fd_cnt)
+    return NULL;
+  struct open_info * info = &t->fds[fd];
+  if (info->file_ptr == NULL && info->dir_ptr == NULL)
+    return NULL;
+  return info;
+}
+
+/* Returns the lowest free fd in the current process's table,
+   growing the table if it is full, or -1 if memory is short. */
 static int
 allocate_fd (void)
 {
-  static int next_fd = 2;
+  struct thread * t = thread_current();
   int fd;
 
-  lock_acquire (&fd_lock);
-  fd = next_fd++;
-  lock_release (&fd_lock);
+  for (fd = t->fd_free > FD_MIN ? t->fd_free : FD_MIN; fd < t->fd_cnt; fd++)
+    if (t->fds[fd].file_ptr == NULL && t->fds[fd].dir_ptr == NULL)
+      break;
+
+  if (fd >= t->fd_cnt) {
+    int new_cnt = t->fd_cnt < FD_TABLE_MIN ? FD_TABLE_MIN : t->fd_cnt * 2;
+    struct open_info * new_fds = realloc(t->fds, new_cnt * sizeof *new_fds);
+    if (new_fds == NULL)
+      return -1;
+    memset(new_fds + t->fd_cnt, 0, (new_cnt - t->fd_cnt) * sizeof *new_fds);
+    t->fds = new_fds;
+    t->fd_cnt = new_cnt;
+  }
 
+  t->fd_free = fd;
   return fd;
 }
 
+/* Releases FD, which must be open in the current process. */
+static void
+free_fd (int fd)
+{
+  struct thread * t = thread_current();
+  struct open_info * info = &t->fds[fd];
+
+  file_close(info->file_ptr);
+  dir_close(info->dir_ptr);
+  info->file_ptr = NULL;
+  info->dir_ptr = NULL;
+  if (fd < t->fd_free)
+    t->fd_free = fd;
+}
+
+/* Closes every fd the current process has open and frees its
+   file descriptor table. */
+static void
+close_all_fds (void)
+{
+  struct thread * t = thread_current();
+  int fd;
+
+  for (fd = FD_MIN; fd < t->fd_cnt; fd++)
+    if (t->fds[fd].file_ptr != NULL || t->fds[fd].dir_ptr != NULL)
+      free_fd(fd);
+
+  free(t->fds);
+  t->fds = NULL;
+  t->fd_cnt = 0;
+  t->fd_free = FD_MIN;
+}
+
+/* Gives the current process its own copy of PARENT's file
+   descriptor table, with every file reopened at the same
+   position.  Returns false if memory is short. */
+bool
+syscall_inherit_fds (struct thread * parent)
+{
+  struct thread * t = thread_current();
+  int fd;
+
+  if (parent->fd_cnt == 0)
+    return true;
+  t->fds = calloc(parent->fd_cnt, sizeof *t->fds);
+  if (t->fds == NULL)
+    return false;
+  t->fd_cnt = parent->fd_cnt;
+  t->fd_free = parent->fd_free;
+
+  for (fd = FD_MIN; fd < t->fd_cnt; fd++) {
+    struct open_info * from = &parent->fds[fd];
+    struct open_info * to = &t->fds[fd];
+
+    if (from->file_ptr != NULL) {
+      to->file_ptr = file_reopen(from->file_ptr);
+      if (to->file_ptr == NULL)
+        return false;
+      file_seek(to->file_ptr, file_tell(from->file_ptr));
+    }
+    else if (from->dir_ptr != NULL) {
+      to->dir_ptr = dir_reopen(from->dir_ptr);
+      if (to->dir_ptr == NULL)
+        return false;
+    }
+  }
+  return true;
+}
+
 struct file * get_file (int fd) {
-  struct file * myfile = NULL;
+  struct open_info * info = get_open_info(fd);
+  return info != NULL ? info->file_ptr : NULL;
+}
+
+#ifdef VM
+/* A memory-mapped file. */
+struct mapping {
+  struct list_elem elem;                /* Element in thread's mappings. */
+  int handle;                           /* Mapping id. */
+  struct file * file;                   /* Mapped file, reopened. */
+  uint8_t * base;                       /* Start of the mapping. */
+  size_t page_cnt;                      /* Number of pages mapped. */
+};
+
+/* Returns the current process's mapping with id HANDLE, or a
+   null pointer if there is none. */
+static struct mapping *
+lookup_mapping (int handle)
+{
+  struct thread * t = thread_current();
   struct list_elem * e;
-  for (e = list_begin(&open_info_list); e != list_end(&open_info_list); e = list_next(e)) {
-    struct open_info * tmp_info = list_entry(e, struct open_info, elem);
-    if (tmp_info->fd == fd && tmp_info->tid == thread_current()->tid) {
-      myfile = tmp_info -> file_ptr;
-      break;
-    }
+
+  for (e = list_begin(&t->mappings); e != list_end(&t->mappings);
+       e = list_next(e)) {
+    struct mapping * m = list_entry(e, struct mapping, elem);
+    if (m->handle == handle)
+      return m;
   }
-  return myfile;
+  return NULL;
+}
+
+/* Removes mapping M from the address space.  Dirty pages are
+   written back to the file as they are deallocated; clean ones
+   cost nothing. */
+static void
+unmap (struct mapping * m)
+{
+  size_t i;
+
+  list_remove(&m->elem);
+  for (i = 0; i < m->page_cnt; i++)
+    page_deallocate(m->base + i * PGSIZE);
+  file_close(m->file);
+  free(m);
+}
+
+/* Removes every mapping the current process has. */
+static void
+unmap_all (void)
+{
+  struct thread * t = thread_current();
+
+  while (!list_empty(&t->mappings))
+    unmap(list_entry(list_front(&t->mappings), struct mapping, elem));
+}
+#endif
+
+/* Releases the current process's open files and mappings. */
+static void
+release_resources (void)
+{
+#ifdef VM
+  unmap_all();
+#endif
+  close_all_fds();
 }
 
-void terminate_process() {
+/* Terminates the current process with exit status -1. */
+void
+terminate_process (void)
+{
   thread_current()->exit_status = -1;
   printf("%s: exit(%d)\n", thread_current()->name, -1);
-  sema_down(&filesys_sema);
-  struct list_elem * e;
-  struct open_info * tmp_info;
-  bool freedsth;
-  while(true) {
-    freedsth = false;
-    for (e = list_begin(&open_info_list); e != list_end(&open_info_list); e = list_next(e)) {
-      tmp_info = list_entry(e, struct open_info, elem);
-      if (tmp_info->tid == thread_current()->tid) {
-        list_remove(&tmp_info->elem);
-        file_close(tmp_info->file_ptr);   
-        dir_close(tmp_info->dir_ptr);
-        free(tmp_info);
-        freedsth = true;
-        break;
-     }
-    }
-    if (!freedsth)
-      break;
-  }
- 
-  sema_up(&filesys_sema);
+  release_resources();
   thread_exit();
 }
 
-bool is_valid (void * pointer) {
-  if (pointer == NULL)
-    return false;
-  if (!is_user_vaddr(pointer))
-    return false;
-  if (pagedir_get_page(thread_current()->pagedir, pointer) == NULL)
-    return false;
-  return true;
+/* Reads a byte at user virtual address UADDR, which must be
+   below PHYS_BASE.  Returns the byte value if successful, -1 if
+   a page fault occurred.  page_fault() recovers by resuming at
+   the address left in eax, with eax set to -1. */
+static inline int
+get_user (const uint8_t * uaddr)
+{
+  int result;
+  asm ("movl $1f, %0; movzbl %1, %0; 1:"
+       : "=&a" (result) : "m" (*uaddr));
+  return result;
 }
 
-bool are_args_locations_valid (void * esp, int argc) {
-  void * tmpptr = esp;
-  int i;
-  for (i = 0; i < argc; i++) {
-    tmpptr = tmpptr + 4;
-    if (!is_valid(tmpptr))
-      return false;
+/* Writes BYTE to user address UDST, which must be below
+   PHYS_BASE.  Returns true if successful, false if a page fault
+   occurred. */
+static inline bool
+put_user (uint8_t * udst, uint8_t byte)
+{
+  int error_code;
+  asm ("movl $1f, %0; movb %b2, %1; 1:"
+       : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+
+/* Copies SIZE bytes from SRC to DST, either of which may be a
+   user address, with the same fault recovery as get_user().
+   Returns false if a page fault occurred. */
+static bool
+copy_user (void * dst, const void * src, size_t size)
+{
+  int error_code;
+  asm volatile ("movl $1f, %0; rep movsb; movl $0, %0; 1:"
+                : "=&a" (error_code), "+S" (src), "+D" (dst), "+c" (size)
+                : : "memory");
+  return error_code == 0;
+}
+
+/* Returns true if the SIZE bytes at user address UADDR lie
+   entirely below PHYS_BASE. */
+static bool
+is_user_range (const void * uaddr, size_t size)
+{
+  return (size == 0
+          || ((const uint8_t *) uaddr + size > (const uint8_t *) uaddr
+              && is_user_vaddr((const uint8_t *) uaddr + size - 1)));
+}
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.  Terminates the process if any of them is inaccessible. */
+static void
+copy_in (void * dst, const void * usrc, size_t size)
+{
+  if (!is_user_range(usrc, size) || !copy_user(dst, usrc, size))
+    terminate_process();
+}
+
+/* Copies SIZE bytes from kernel address SRC to user address
+   UDST.  Terminates the process if any of them is
+   inaccessible. */
+static void
+copy_out (void * udst, const void * src, size_t size)
+{
+  if (!is_user_range(udst, size) || !copy_user(udst, src, size))
+    terminate_process();
+}
+
+/* Copies the null-terminated string at user address US into a
+   new page, truncating it to PGSIZE - 1 characters.  Returns the
+   page, which the caller must free, or a null pointer if no page
+   is available.  Terminates the process if the string is
+   inaccessible. */
+static char *
+copy_in_string (const char * us)
+{
+  char * ks = palloc_get_page(0);
+  size_t length;
+
+  if (ks == NULL)
+    return NULL;
+  for (length = 0; length < PGSIZE - 1; length++) {
+    int c = is_user_vaddr(us + length) ? get_user((const uint8_t *) us + length) : -1;
+    if (c == -1) {
+      palloc_free_page(ks);
+      terminate_process();
+    }
+    ks[length] = c;
+    if (c == '\0')
+      return ks;
   }
-  return true;
+  ks[length] = '\0';
+  return ks;
 }
 
-int write (void * esp) {
-  int argc = 3;
-  
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process(); 
+/* Copies the ARGC argument words that follow the system call
+   number at user address ESP into ARGS. */
+static void
+get_args (void * esp, uint32_t * args, int argc)
+{
+  copy_in(args, (uint32_t *) esp + 1, argc * sizeof *args);
+}
 
-  int fd = * (int *) (esp + 4);
-  void * buffer = * (void **) (esp + 8);
-  unsigned size = * (unsigned *) (esp + 12);
-  
-  if (!is_valid(buffer) || !is_valid(buffer + size))
+/* Makes sure the page containing user address UADDR stays
+   resident until unpin_page(), so that the file system can copy
+   to or from it directly without faulting while it holds its own
+   locks.  If WILL_WRITE, the page must also be writable.
+   Returns false if the page is not accessible. */
+static bool
+pin_page (void * uaddr, bool will_write)
+{
+#ifdef VM
+  return page_lock(uaddr, will_write);
+#else
+  int c = get_user(uaddr);
+  return c != -1 && (!will_write || put_user(uaddr, c));
+#endif
+}
+
+/* Releases a page pinned with pin_page(). */
+static void
+unpin_page (void * uaddr UNUSED)
+{
+#ifdef VM
+  page_unlock(uaddr);
+#endif
+}
+
+/* Reads (if READING) or writes SIZE bytes between FILE, or the
+   console if FILE is null, and user BUFFER, one pinned page at a
+   time.  Returns the number of bytes transferred.  Terminates the
+   process if any page of BUFFER is inaccessible. */
+static int
+transfer (struct file * file, uint8_t * buffer, unsigned size, bool reading)
+{
+  int total = 0;
+
+  if (!is_user_range(buffer, size))
     terminate_process();
+  while (size > 0) {
+    size_t chunk = PGSIZE - pg_ofs(buffer);
+    off_t done;
+
+    if (chunk > size)
+      chunk = size;
+    if (!pin_page(buffer, reading))
+      terminate_process();
+    if (file == NULL) {
+      putbuf((char *) buffer, chunk);
+      done = chunk;
+    }
+    else if (reading)
+      done = file_read(file, buffer, chunk);
+    else
+      done = file_write(file, buffer, chunk);
+    unpin_page(buffer);
+
+    total += done;
+    if (done != (off_t) chunk)
+      break;
+    buffer += chunk;
+    size -= chunk;
+  }
+  return total;
+}
+
+static uint32_t sys_halt (const uint32_t * args UNUSED) {
+  power_off();
+}
+
+static uint32_t sys_write (const uint32_t * args) {
+
+  int fd = args[0];
+  void * buffer = (void *) args[1];
+  unsigned size = args[2];
  
   if (fd == 0)
     terminate_process();
-  else if (fd == 1) {
-    putbuf(buffer, size);
-    return size;
-  }
+  else if (fd == 1)
+    return transfer(NULL, buffer, size, false);
   else  {
-    sema_down(&filesys_sema);
     struct file * myfile = get_file(fd);
-    sema_up(&filesys_sema);
     if (myfile == NULL)
       terminate_process();
 
-    void * tmp_buffer = malloc(size);
-    memcpy(tmp_buffer, buffer,size);
-    int result = file_write (myfile, tmp_buffer, size);
-    free(tmp_buffer);
-    return result;
+    return transfer(myfile, buffer, size, false);
   }
 }
 
-int read (void * esp) {
-  int argc = 3;
+static uint32_t sys_read (const uint32_t * args) {
 
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
-
-  int fd = * (int *) (esp + 4);
-  void * buffer = * (void **) (esp + 8);
-  unsigned size = * (unsigned *) (esp + 12);
-
-  if (!is_valid(buffer) || !is_valid(buffer + size))
-    terminate_process();
+  int fd = args[0];
+  void * buffer = (void *) args[1];
+  unsigned size = args[2];
 
   if (fd == 0) {
     return 0;
@@ -167,512 +429,386 @@ int read (void * esp) {
   else if (fd == 1)
     return 0;
   else {
-    sema_down(&filesys_sema);
     struct file * myfile = get_file(fd);
-    sema_up(&filesys_sema);
     if (myfile == NULL)
       return -1;
-    void * tmp_buffer = malloc(size);
-    int result = file_read (myfile, tmp_buffer, size);
-    memcpy(buffer, tmp_buffer,size);
-    free(tmp_buffer);
-    return result;
+    return transfer(myfile, buffer, size, true);
   }
 }
 
-void seek(void * esp) {
-  int argc = 2;
-
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
+static uint32_t sys_seek (const uint32_t * args) {
 
-  int fd  = * (int *) (esp + 4);
-  unsigned position = * (unsigned *) (esp + 8);
-  unsigned result;
-  sema_down(&filesys_sema);
+  int fd  = args[0];
+  unsigned position = args[1];
   struct file * myfile = get_file(fd);
-  sema_up(&filesys_sema);
-  file_seek(myfile, position);
+  if (myfile != NULL)
+    file_seek(myfile, position);
+  return 0;
 }
 
-unsigned tell(void * esp) {
-  int argc = 1;
-
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
+static uint32_t sys_tell (const uint32_t * args) {
 
-  int fd  = * (int *) (esp + 4);
-  sema_down(&filesys_sema);
+  int fd  = args[0];
   struct file * myfile = get_file(fd);
-  sema_up(&filesys_sema);
+  if (myfile == NULL)
+    return 0;
   return file_tell(myfile);
 }
 
-void close(void * esp) {
-  int argc = 1;
-  
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
+static uint32_t sys_close (const uint32_t * args) {
 
-  int fd = * (int *) (esp + 4);
-  sema_down(&filesys_sema);
-  struct file * myfile = NULL;
-  struct list_elem * e;
-  for (e = list_begin(&open_info_list); e != list_end(&open_info_list); e = list_next(e)) {
-    struct open_info * tmp_info = list_entry(e, struct open_info, elem);
-    if (tmp_info->fd == fd && tmp_info->tid == thread_current()->tid) {
-      myfile = tmp_info -> file_ptr;
-      list_remove(&tmp_info->elem);
-      free(tmp_info);
-      break;
-    }
-  }
-  file_close(myfile);
-  sema_up(&filesys_sema);
+  int fd = args[0];
+  if (get_open_info(fd) != NULL)
+    free_fd(fd);
+  return 0;
 }
 
-tid_t exec(void * esp) {
-  int argc = 1;
-
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
+static uint32_t sys_exec (const uint32_t * args) {
 
-  char * cmd_line = * (char * *) (esp + 4);
-
-  if (!is_valid(cmd_line))
-    terminate_process();
-  
-  char * argv_copy = palloc_get_page (0);
+  char * argv_copy = copy_in_string((const char *) args[0]);
   if (argv_copy == NULL)
     return TID_ERROR;
-  strlcpy (argv_copy, cmd_line, PGSIZE);
 
   tid_t result = process_execute(argv_copy);
   palloc_free_page(argv_copy);
   return result;
 }
 
-int filesize (void * esp) {
-  int argc = 1;
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
+static uint32_t sys_filesize (const uint32_t * args) {
 
-  int fd = * (int *) (esp + 4);
-  sema_down(&filesys_sema);
-  struct file * myfile = NULL;
-  struct list_elem * e;
-  
-  for (e = list_begin(&open_info_list); e != list_end(&open_info_list); e = list_next(e)) {
-    struct open_info * tmp_info = list_entry(e, struct open_info, elem);
-    
-    if (tmp_info->fd == fd) {
-      myfile = tmp_info -> file_ptr;
-      break;
-    }
-    
-  }
-  if (myfile == NULL) {
-    sema_up(&filesys_sema);
+  int fd = args[0];
+  struct file * myfile = get_file(fd);
+  if (myfile == NULL)
     return -1;
-  }
-  int result = file_length(myfile);
-  sema_up(&filesys_sema);
-  return result;
+  return file_length(myfile);
 }
 
-void exit (void * esp) {
-  int argc = 1;
- 
- if (!are_args_locations_valid(esp, argc))
-    terminate_process(); 
+static uint32_t sys_exit (const uint32_t * args) {
 
-  int status = * (int *) (esp + 4);
+  int status = args[0];
   thread_current()->exit_status = status;
   printf("%s: exit(%d)\n", thread_current()->name, status);
-  sema_down(&filesys_sema);  
-  struct list_elem * e;
-  struct open_info * tmp_info;
-  bool freedsth;
-  while(true) {
-    freedsth = false;
-    for (e = list_begin(&open_info_list); e != list_end(&open_info_list); e = list_next(e)) {
-      tmp_info = list_entry(e, struct open_info, elem);
-      if (tmp_info->tid == thread_current()->tid) {
-        list_remove(&tmp_info->elem);
-        file_close(tmp_info->file_ptr);
-        dir_close(tmp_info->dir_ptr);
-        free(tmp_info);
-        freedsth = true;
-        break;
-     }
-    }
-    if (!freedsth)
-      break;
-  }
-
-  sema_up(&filesys_sema);
-
+  release_resources();
   thread_exit();
 }
 
-int wait (void * esp) {
-  int argc = 1;
-
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
+static uint32_t sys_wait (const uint32_t * args) {
   
-  tid_t tid = * (tid_t *) (esp + 4);
+  tid_t tid = args[0];
   
   return process_wait(tid);
 }
 
-bool create(void * esp) {
-  int argc = 2;
-  
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
-
-  char * path  = * (char * *) (esp + 4);
+static uint32_t sys_create (const uint32_t * args) {
 
-  if (!is_valid(path))
-    terminate_process();
+  char * path = copy_in_string((const char *) args[0]);
+  if (path == NULL)
+    return false;
   
-  unsigned initial_size = * (unsigned *) (esp + 8);
-  sema_down(&filesys_sema);
+  unsigned initial_size = args[1];
   disk_sector_t sector;
   bool result = traverse_path(path, &sector, NULL, 1, &initial_size);
-  sema_up(&filesys_sema);
+  palloc_free_page(path);
 
   return result;
 }
 
-bool remove(void * esp) {
-  int argc = 1;
+static uint32_t sys_remove (const uint32_t * args) {
 
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
-
-  char * path  = * (char * *) (esp + 4);
-
-  if (!is_valid(path))
-    terminate_process();
+  char * path = copy_in_string((const char *) args[0]);
+  if (path == NULL)
+    return false;
 
-  sema_down(&filesys_sema);
   char * name;
   disk_sector_t sector;
   if (!traverse_path(path, &sector, &name, 0, NULL)) {
-    sema_up(&filesys_sema);
+    palloc_free_page(path);
     return false;
   }
+  palloc_free_page(path);
+
+  /* dir_remove() refuses to remove a directory that is not
+     empty. */
   bool result = false;
-  struct inode * cur_inode = NULL, * parent_inode;
-  struct dir * cur_dir, * parent_dir;
-  struct list_elem * e;
-  for (e = list_begin(&open_info_list); e != list_end(&open_info_list); e = list_next(e)) {
-     struct open_info * tmp_info = list_entry(e, struct open_info, elem);
-     if (tmp_info->file_ptr != NULL && file_get_inode(tmp_info->file_ptr)->sector == sector) {
-       cur_inode = inode_reopen(file_get_inode(tmp_info->file_ptr));
-       break;
-     }
-     if (tmp_info->dir_ptr != NULL && dir_get_inode(tmp_info->dir_ptr)->sector == sector) {
-       cur_inode = inode_reopen(dir_get_inode(tmp_info->dir_ptr));
-       break;
-     }
-  }
-  if (cur_inode == NULL)
-    cur_inode = inode_open(sector);
-  parent_inode = inode_open(cur_inode->data.parent);
-  parent_dir = dir_open(parent_inode);
-
-  if (cur_inode->data.is_dir) {
-    cur_dir = dir_open(cur_inode);
-    char tmp_buffer[20];
-    if (dir_readdir (cur_dir, tmp_buffer)) {
-      result = false;
-      dir_close(cur_dir);
-    }
-    else {
-      result = dir_remove (parent_dir, name, false);
-      inode_remove(cur_inode);
-      dir_close(cur_dir);
-    }
-  }
-  else {
-    result = dir_remove (parent_dir, name, false);
-    if (result)
-      inode_remove(cur_inode);
-    inode_close(cur_inode);
-  }
+  struct inode * cur_inode = inode_open(sector);
+  struct dir * parent_dir = dir_open(inode_open(cur_inode->data.parent));
+  inode_close(cur_inode);
+  if (parent_dir != NULL)
+    result = dir_remove (parent_dir, name, true);
 
   dir_close(parent_dir);
   palloc_free_page(name);
-  sema_up(&filesys_sema);
 
   return result;
 }
 
-int open(void * esp) {
-  int argc = 1;
+static uint32_t sys_open (const uint32_t * args) {
 
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
-
-  char * path  = * (char * *) (esp + 4);
-
-  if (!is_valid(path))
-    terminate_process();
+  char * path = copy_in_string((const char *) args[0]);
+  if (path == NULL)
+    return -1;
 
-  sema_down(&filesys_sema);
   disk_sector_t sector;
   char * name;
-  if (!traverse_path(path, &sector, &name, 0, NULL)) {
-    sema_up(&filesys_sema);
+  bool found = traverse_path(path, &sector, &name, 0, NULL);
+  palloc_free_page(path);
+  if (!found)
     return -1;
-  }
 
-  struct open_info *  new_info = malloc(sizeof (struct open_info));
-  if (new_info == NULL) {
-    sema_up(&filesys_sema);
+  int new_fd = allocate_fd();
+  if (new_fd < 0) {
     palloc_free_page(name);
     return -1;
   }
-
-  int new_fd = allocate_fd();
-  new_info->fd = new_fd;
-  new_info->file_ptr = NULL;
-  new_info->dir_ptr = NULL;
-  new_info->tid = thread_current()->tid;
-  bool reopened = false;
-
-  struct list_elem * e;
-  for (e = list_begin(&open_info_list); e != list_end(&open_info_list); e = list_next(e)) {
-    struct open_info * tmp_info = list_entry(e, struct open_info, elem);
-    if (tmp_info->file_ptr != NULL && file_get_inode(tmp_info->file_ptr)->sector == sector) {
-      new_info->file_ptr = file_reopen(tmp_info->file_ptr);
-      reopened = true;
-      break;
-    }
-    if (tmp_info->dir_ptr != NULL && dir_get_inode(tmp_info->dir_ptr)->sector == sector) {
-      new_info->dir_ptr = dir_reopen(tmp_info->dir_ptr);
-      reopened = true;
-      break;
-    }
-  }
-
-  if (!reopened) {
-    struct inode * inode = inode_open(sector);
-    if (inode->data.is_dir)
-      new_info->dir_ptr = dir_open(inode);
-    else
-      new_info->file_ptr = file_open(inode);
-  }
-  list_push_back(&open_info_list, &new_info->elem);
-  if (new_info->file_ptr != NULL) {
+  struct open_info * new_info = &thread_current()->fds[new_fd];
+
+  /* inode_open() shares an already open inode with its other
+     openers, so there is no need to look for one here. */
+  struct inode * inode = inode_open(sector);
+  if (inode->data.is_dir)
+    new_info->dir_ptr = dir_open(inode);
+  else
+    new_info->file_ptr = file_open(inode);
+  if (new_info->file_ptr == NULL && new_info->dir_ptr == NULL)
+    new_fd = -1;
+  else if (new_info->file_ptr != NULL) {
     if (strcmp(name, thread_current()->name) == 0)
       file_deny_write(new_info->file_ptr);
   }
   palloc_free_page(name);
-  sema_up(&filesys_sema);
   return new_fd;
 }
 
-bool isdir(void * esp) {
-  int argc = 1;
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
+static uint32_t sys_isdir (const uint32_t * args) {
 
-  int fd = * (int *) (esp + 4);
+  int fd = args[0];
 
-  sema_down(&filesys_sema);
-  bool result;
-  struct list_elem * e;
-  for (e = list_begin(&open_info_list); e != list_end(&open_info_list); e = list_next(e)) {
-    struct open_info * tmp_info = list_entry(e, struct open_info, elem);
-    if (tmp_info->fd == fd && tmp_info->tid == thread_current()->tid) {
-      if (tmp_info->file_ptr != NULL)
-        result = false;
-      else
-        result = true;
-    }
-  }
-  sema_up(&filesys_sema);
+  struct open_info * info = get_open_info(fd);
+  bool result = info != NULL && info->dir_ptr != NULL;
 
   return result;
 }
 
-int inumber(void * esp) {
-  int argc = 1;
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
+static uint32_t sys_inumber (const uint32_t * args) {
 
-  int fd = * (int *) (esp + 4);
+  int fd = args[0];
 
-  sema_down(&filesys_sema);
-  int result;
-  struct list_elem * e;
-  for (e = list_begin(&open_info_list); e != list_end(&open_info_list); e = list_next(e)) {
-    struct open_info * tmp_info = list_entry(e, struct open_info, elem);
-    if (tmp_info->fd == fd && tmp_info->tid == thread_current()->tid) {
-      if (tmp_info->dir_ptr)
-        result = dir_get_inode(tmp_info->dir_ptr)->sector;
-      else
-        result = file_get_inode(tmp_info->file_ptr)->sector;
-    }
-  }
-  sema_up(&filesys_sema);
+  struct open_info * info = get_open_info(fd);
+  int result = -1;
+  if (info != NULL && info->dir_ptr != NULL)
+    result = dir_get_inode(info->dir_ptr)->sector;
+  else if (info != NULL)
+    result = file_get_inode(info->file_ptr)->sector;
 
   return result;
 }
 
-bool readdir(void * esp) {
-  int argc = 2;
-
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
+static uint32_t sys_readdir (const uint32_t * args) {
 
-  int fd = * (int *) (esp + 4);
-  char * name = * (char **) (esp + 8);
-
-  if (!is_valid(name))
-    terminate_process();
+  int fd = args[0];
+  char * name = (char *) args[1];
+  char kname[NAME_MAX + 1];
 
   bool result = false;
-  sema_down(&filesys_sema);
-  struct list_elem * e;
-  for (e = list_begin(&open_info_list); e != list_end(&open_info_list); e = list_next(e)) {
-    struct open_info * tmp_info = list_entry(e, struct open_info, elem);
-    if (tmp_info->fd == fd && tmp_info->tid == thread_current()->tid && tmp_info->dir_ptr != NULL) {
-      result = dir_readdir(tmp_info->dir_ptr, name);
-      break;
-    }
-  }
-  sema_up(&filesys_sema);
+  struct open_info * info = get_open_info(fd);
+  if (info != NULL && info->dir_ptr != NULL)
+    result = dir_readdir(info->dir_ptr, kname);
+  if (result)
+    copy_out(name, kname, strlen(kname) + 1);
   return result;
 }
 
-bool mkdir(void * esp) {
-   int argc = 1;
+static uint32_t sys_mkdir (const uint32_t * args) {
 
-   if (!are_args_locations_valid(esp, argc))
-     terminate_process();
-
-   char * dir  = * (char * *) (esp + 4);
-
-   if (!is_valid(dir))
-     terminate_process();
-
-   char * dir_copy  = palloc_get_page (0);
+   char * dir_copy = copy_in_string((const char *) args[0]);
    if (dir_copy == NULL)
-     return -1;
-   strlcpy (dir_copy, dir, PGSIZE);
-   sema_down(&filesys_sema);
+     return false;
    disk_sector_t sector;
-   bool rs = traverse_path(dir_copy, sector, NULL, 2, NULL);
-   sema_up(&filesys_sema);
+   bool rs = traverse_path(dir_copy, &sector, NULL, 2, NULL);
    palloc_free_page(dir_copy);
    return rs;
 }
 
-bool chdir(void * esp) {
-  int argc = 1;
-
-  if (!are_args_locations_valid(esp, argc))
-    terminate_process();
-
-  char * dir  = * (char * *) (esp + 4);
+static uint32_t sys_chdir (const uint32_t * args) {
 
-  if (!is_valid(dir))
-    terminate_process();
+  char * dir = copy_in_string((const char *) args[0]);
+  if (dir == NULL)
+    return false;
 
-  sema_down(&filesys_sema);
   disk_sector_t sector;
-  if (!traverse_path(dir, &sector, NULL, 0, NULL)) {
-    sema_up(&filesys_sema);
+  bool found = traverse_path(dir, &sector, NULL, 0, NULL);
+  palloc_free_page(dir);
+  if (!found)
     return false;
+  struct inode * inode = inode_open(sector);
+  thread_current()->cur_dir = dir_open(inode);
+  return true;
+}
+
+#ifdef VM
+static uint32_t sys_mmap (const uint32_t * args) {
+
+  int fd = args[0];
+  uint8_t * addr = (uint8_t *) args[1];
+  struct thread * t = thread_current();
+  struct file * myfile = get_file(fd);
+  struct mapping * m;
+  off_t length, offset;
+
+  if (myfile == NULL || addr == NULL || pg_ofs(addr) != 0)
+    return -1;
+  length = file_length(myfile);
+  if (length == 0 || !is_user_range(addr, length))
+    return -1;
+
+  m = malloc(sizeof *m);
+  if (m == NULL)
+    return -1;
+  /* A separate open keeps the mapping valid after the fd is
+     closed or the file is removed. */
+  m->file = file_reopen(myfile);
+  if (m->file == NULL) {
+    free(m);
+    return -1;
   }
-  bool rs = false;
-  struct list_elem * e;
-  for (e = list_begin(&open_info_list); e != list_end(&open_info_list); e = list_next(e)) {
-    struct open_info * tmp_info = list_entry(e, struct open_info, elem);
-    if (tmp_info->dir_ptr != NULL && dir_get_inode(tmp_info->dir_ptr)->sector == sector) {
-      thread_current()->cur_dir = dir_reopen(tmp_info->dir_ptr);
-      rs = true;
-      break;
+  m->handle = t->next_mapid++;
+  m->base = addr;
+  m->page_cnt = 0;
+  list_push_front(&t->mappings, &m->elem);
+
+  /* Pages are read through the buffer cache on first touch. */
+  for (offset = 0; offset < length; offset += PGSIZE) {
+    struct page * p = page_allocate(addr + offset, false);
+    if (p == NULL) {
+      unmap(m);
+      return -1;
     }
+    p->private = false;
+    p->file = m->file;
+    p->file_offset = offset;
+    p->file_bytes = length - offset < PGSIZE ? length - offset : PGSIZE;
+    m->page_cnt++;
   }
-  if (!rs) {
-    struct inode * inode = inode_open(sector);
-    thread_current()->cur_dir = dir_open(inode);
-    rs = true;
-  }
-  sema_up(&filesys_sema);
-  return rs;
+  return m->handle;
 }
 
+static uint32_t sys_munmap (const uint32_t * args) {
+
+  struct mapping * m = lookup_mapping(args[0]);
+  if (m != NULL)
+    unmap(m);
+  return 0;
+}
+
+static uint32_t sys_fork (const uint32_t * args UNUSED) {
+
+  /* The frame through which a process enters the kernel is at
+     the top of its thread's kernel stack. */
+  const struct intr_frame * f =
+    (const struct intr_frame *) ((uint8_t *) thread_current() + PGSIZE) - 1;
+  return process_fork(f);
+}
+#endif
+
+/* A system call. */
+struct syscall
+  {
+    const char * name;                  /* Name, for statistics. */
+    int argc;                           /* Number of argument words. */
+    uint32_t (*func) (const uint32_t * args); /* Implementation. */
+
+    /* Statistics, in timer ticks. */
+    long long call_cnt;                 /* Number of calls. */
+    int64_t total_ticks;                /* Total time spent. */
+    int64_t max_ticks;                  /* Longest single call. */
+  };
+
+/* Largest argc in the table below. */
+#define SYSCALL_MAX_ARGS 3
+
+/* System calls, indexed by SYS_* number.  Calls with a null FUNC
+   are not implemented. */
+static struct syscall syscalls[] =
+  {
+    [SYS_HALT]     = {"halt",     0, sys_halt},
+    [SYS_EXIT]     = {"exit",     1, sys_exit},
+    [SYS_EXEC]     = {"exec",     1, sys_exec},
+    [SYS_WAIT]     = {"wait",     1, sys_wait},
+    [SYS_CREATE]   = {"create",   2, sys_create},
+    [SYS_REMOVE]   = {"remove",   1, sys_remove},
+    [SYS_OPEN]     = {"open",     1, sys_open},
+    [SYS_FILESIZE] = {"filesize", 1, sys_filesize},
+    [SYS_READ]     = {"read",     3, sys_read},
+    [SYS_WRITE]    = {"write",    3, sys_write},
+    [SYS_SEEK]     = {"seek",     2, sys_seek},
+    [SYS_TELL]     = {"tell",     1, sys_tell},
+    [SYS_CLOSE]    = {"close",    1, sys_close},
+#ifdef VM
+    [SYS_MMAP]     = {"mmap",     2, sys_mmap},
+    [SYS_MUNMAP]   = {"munmap",   1, sys_munmap},
+#else
+    [SYS_MMAP]     = {"mmap",     2, NULL},
+    [SYS_MUNMAP]   = {"munmap",   1, NULL},
+#endif
+    [SYS_CHDIR]    = {"chdir",    1, sys_chdir},
+    [SYS_MKDIR]    = {"mkdir",    1, sys_mkdir},
+    [SYS_READDIR]  = {"readdir",  2, sys_readdir},
+    [SYS_ISDIR]    = {"isdir",    1, sys_isdir},
+    [SYS_INUMBER]  = {"inumber",  1, sys_inumber},
+#ifdef VM
+    [SYS_FORK]     = {"fork",     0, sys_fork},
+#else
+    [SYS_FORK]     = {"fork",     0, NULL},
+#endif
+  };
+
+/* Adds a call to SC that took TICKS timer ticks to its
+   statistics.  Exit never returns here, so its calls are counted
+   without being timed. */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+record_call (struct syscall * sc, int64_t ticks)
+{
+  enum intr_level old_level = intr_disable();
+  sc->call_cnt++;
+  sc->total_ticks += ticks;
+  if (ticks > sc->max_ticks)
+    sc->max_ticks = ticks;
+  intr_set_level(old_level);
+}
+
+static void
+syscall_handler (struct intr_frame *f) 
 {
   uint32_t syscall_nb;
-  if (!is_valid(f->esp))
+  uint32_t args[SYSCALL_MAX_ARGS];
+  struct syscall * sc;
+  int64_t start;
+
+#ifdef VM
+  thread_current()->user_esp = f->esp;
+#endif
+  copy_in(&syscall_nb, f->esp, sizeof syscall_nb);
+  if (syscall_nb >= sizeof syscalls / sizeof *syscalls
+      || syscalls[syscall_nb].func == NULL)
     terminate_process();
-  syscall_nb = * (uint32_t *) f->esp;
-  switch(syscall_nb) {
-    case SYS_HALT:                   /* Halt the operating system. */
-      power_off();
-      break;
-    case SYS_EXIT:                   /* Terminate this process. */
-      exit(f->esp);
-      break;
-    case SYS_EXEC:                   /* Start another process. */
-      f->eax = exec(f->esp);
-      break;
-    case SYS_WAIT:                   /* Wait for a child process to die. */
-      f->eax = wait(f->esp);
-      break;
-    case SYS_CREATE:                 /* Create a file. */
-      f->eax = create(f->esp);
-      break;
-    case SYS_REMOVE:                 /* Delete a file. */
-      f->eax = remove(f->esp);
-      break;
-    case SYS_OPEN:                   /* Open a file. */
-      f->eax = open(f->esp);
-      break;
-    case SYS_FILESIZE:               /* Obtain a file's size. */
-      f->eax = filesize(f->esp);
-      break;
-    case SYS_READ:                   /* Read from a file. */
-      f->eax = read(f->esp);
-      break;
-    case SYS_WRITE:                  /* Write to a file. */
-      f->eax = write(f->esp);
-      break;
-    case SYS_SEEK:                   /* Change position in a file. */
-      seek(f->esp);
-      break;
-    case SYS_TELL:                   /* Report current position in a file. */
-      f->eax = tell(f->esp);
-      break;
-    case SYS_CLOSE:                  /* Close a file. */
-      close(f->esp);
-      break;
-    case SYS_CHDIR:                  /* Change the current directory. */
-      f->eax = chdir(f->esp);
-      break;
-    case SYS_MKDIR:                  /* Create a directory. */
-      f->eax = mkdir(f->esp);
-      break;
-    case SYS_READDIR:                /* Reads a directory entry. */
-      f->eax = readdir(f->esp);
-      break;
-    case SYS_ISDIR:                  /* Tests if a fd represents a directory. */
-      f->eax = isdir(f->esp);
-      break;
-    case SYS_INUMBER:                /* Returns the inode number for a fd. */
-      f->eax = inumber(f->esp);
-      break;
-    default:
-      terminate_process();
-      break;
-  }
+  sc = &syscalls[syscall_nb];
+  get_args(f->esp, args, sc->argc);
+
+  if (sc->func == sys_exit)
+    record_call(sc, 0);
+  start = timer_ticks();
+  f->eax = sc->func(args);
+  record_call(sc, timer_elapsed(start));
+}
+
+/* Prints system call statistics. */
+void
+syscall_print_stats (void) 
+{
+  const struct syscall * sc;
+
+  for (sc = syscalls; sc < syscalls + sizeof syscalls / sizeof *syscalls; sc++)
+    if (sc->call_cnt > 0)
+      printf ("Syscall %s: %lld calls, %lld ticks total, %lld ticks max\n",
+              sc->name, sc->call_cnt, sc->total_ticks, sc->max_ticks);
 }
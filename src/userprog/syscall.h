@@ -1,6 +1,14 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <debug.h>
+#include <stdbool.h>
+
+struct thread;
+
 void syscall_init (void);
+void syscall_print_stats (void);
+bool syscall_inherit_fds (struct thread *parent);
+void terminate_process (void) NO_RETURN;
 
 #endif /* userprog/syscall.h */
@@ -0,0 +1,318 @@
+#include "vm/frame.h"
+#include <stdio.h>
+#include "vm/page.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Every page in the user pool, as a frame.  Pages are taken
+   from the user pool once, at startup, and never returned. */
+static struct frame *frames;
+static size_t frame_cnt;
+
+/* A page of zeros, mapped read-only in place of every anonymous
+   page that has not been written yet.  Not part of the frame
+   table: it is never evicted or freed. */
+void *zero_page;
+
+/* Serializes searches for a frame to allocate. */
+static struct lock scan_lock;
+
+/* Clock hand: the frame the next eviction scan starts at. */
+static size_t hand;
+
+/* Frames holding read-only executable data, keyed by the file's
+   inode sector and the offset of the data in the file.  Lets
+   processes running the same program share its text.
+   Lock ordering: a frame's lock before shared_lock. */
+static struct hash shared_frames;
+static struct lock shared_lock;
+
+static hash_hash_func shared_hash;
+static hash_less_func shared_less;
+
+/* Initializes the frame manager. */
+void
+frame_init (void) 
+{
+  void *base;
+
+  lock_init (&scan_lock);
+  lock_init (&shared_lock);
+  hash_init (&shared_frames, shared_hash, shared_less, NULL);
+  
+  frames = malloc (sizeof *frames * ram_pages);
+  if (frames == NULL)
+    PANIC ("out of memory allocating page frames");
+
+  zero_page = palloc_get_page (PAL_USER | PAL_ZERO);
+  if (zero_page == NULL)
+    PANIC ("out of memory allocating zero page");
+
+  while ((base = palloc_get_page (PAL_USER)) != NULL) 
+    {
+      struct frame *f = &frames[frame_cnt++];
+      lock_init (&f->lock);
+      f->base = base;
+      list_init (&f->pages);
+      f->shared = false;
+    }
+}
+
+/* Returns a hash value for shared frame E. */
+static unsigned
+shared_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct frame *f = hash_entry (e, struct frame, hash_elem);
+  return hash_int (f->sector) ^ hash_int (f->offset);
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+shared_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED) 
+{
+  const struct frame *a = hash_entry (a_, struct frame, hash_elem);
+  const struct frame *b = hash_entry (b_, struct frame, hash_elem);
+
+  if (a->sector != b->sector)
+    return a->sector < b->sector;
+  return a->offset < b->offset;
+}
+
+/* Removes locked frame F from shared_frames, if it is there. */
+static void
+unshare (struct frame *f) 
+{
+  if (f->shared) 
+    {
+      lock_acquire (&shared_lock);
+      hash_delete (&shared_frames, &f->hash_elem);
+      lock_release (&shared_lock);
+      f->shared = false;
+    }
+}
+
+/* Returns true if any page mapped to locked frame F has been
+   accessed recently, clearing all of their accessed bits. */
+static bool
+frame_accessed_recently (struct frame *f) 
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    if (page_accessed_recently (list_entry (e, struct page, frame_elem)))
+      accessed = true;
+  return accessed;
+}
+
+/* Evicts every page mapped to locked frame F.
+   Returns true if successful, false on failure. */
+static bool
+evict (struct frame *f) 
+{
+  while (!list_empty (&f->pages)) 
+    {
+      struct page *p = list_entry (list_front (&f->pages),
+                                   struct page, frame_elem);
+      if (!page_out (p))
+        return false;
+      list_pop_front (&f->pages);
+    }
+  unshare (f);
+  return true;
+}
+
+/* Tries to allocate and lock a frame for PAGE.
+   Returns the frame if successful, false on failure. */
+static struct frame *
+try_frame_alloc_and_lock (struct page *page) 
+{
+  size_t i;
+
+  lock_acquire (&scan_lock);
+
+  /* Find a free frame. */
+  for (i = 0; i < frame_cnt; i++)
+    {
+      struct frame *f = &frames[i];
+      if (lock_held_by_current_thread (&f->lock)
+          || !lock_try_acquire (&f->lock))
+        continue;
+      if (list_empty (&f->pages)) 
+        {
+          list_push_back (&f->pages, &page->frame_elem);
+          lock_release (&scan_lock);
+          return f;
+        } 
+      lock_release (&f->lock);
+    }
+
+  /* No free frame.  Find a frame to evict, giving each frame
+     whose page was accessed since the hand last passed it a
+     second chance.  Two trips around the clock are enough to
+     find one unless every frame is locked. */
+  for (i = 0; i < frame_cnt * 2; i++) 
+    {
+      /* Get a frame. */
+      struct frame *f = &frames[hand];
+      if (++hand >= frame_cnt)
+        hand = 0;
+
+      /* Skip frames in use, including one the caller holds
+         while copying it on write. */
+      if (lock_held_by_current_thread (&f->lock)
+          || !lock_try_acquire (&f->lock))
+        continue;
+
+      if (list_empty (&f->pages)) 
+        {
+          list_push_back (&f->pages, &page->frame_elem);
+          lock_release (&scan_lock);
+          return f;
+        } 
+
+      if (frame_accessed_recently (f)) 
+        {
+          lock_release (&f->lock);
+          continue;
+        }
+          
+      lock_release (&scan_lock);
+      
+      /* Evict this frame. */
+      if (!evict (f))
+        {
+          lock_release (&f->lock);
+          return NULL;
+        }
+
+      list_push_back (&f->pages, &page->frame_elem);
+      return f;
+    }
+
+  lock_release (&scan_lock);
+  return NULL;
+}
+
+/* Tries really hard to allocate and lock a frame for PAGE.
+   Returns the frame if successful, false on failure. */
+struct frame *
+frame_alloc_and_lock (struct page *page) 
+{
+  size_t try;
+
+  for (try = 0; try < 3; try++) 
+    {
+      struct frame *f = try_frame_alloc_and_lock (page);
+      if (f != NULL) 
+        {
+          ASSERT (lock_held_by_current_thread (&f->lock));
+          return f; 
+        }
+      timer_msleep (1000);
+    }
+
+  return NULL;
+}
+
+/* Looks for a frame that already holds the data at OFFSET in
+   the file whose inode is at SECTOR, for read-only page PAGE.
+   Returns the frame, locked and with PAGE mapped to it, or a null
+   pointer if no frame holds that data. */
+struct frame *
+frame_find_shared_and_lock (struct page *page, disk_sector_t sector,
+                            off_t offset) 
+{
+  struct frame key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  key.offset = offset;
+  for (;;) 
+    {
+      struct frame *f;
+
+      lock_acquire (&shared_lock);
+      e = hash_find (&shared_frames, &key.hash_elem);
+      lock_release (&shared_lock);
+      if (e == NULL)
+        return NULL;
+
+      /* The frame may have been evicted, and even reused, while
+         we waited for its lock. */
+      f = hash_entry (e, struct frame, hash_elem);
+      lock_acquire (&f->lock);
+      if (f->shared && f->sector == sector && f->offset == offset) 
+        {
+          list_push_back (&f->pages, &page->frame_elem);
+          return f;
+        }
+      lock_release (&f->lock);
+    }
+}
+
+/* Offers locked frame F, which holds the data at OFFSET in the
+   file whose inode is at SECTOR, to other processes through
+   frame_find_shared_and_lock().  If another frame already holds
+   the same data, F simply stays private. */
+void
+frame_share (struct frame *f, disk_sector_t sector, off_t offset) 
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (!f->shared);
+
+  f->sector = sector;
+  f->offset = offset;
+  lock_acquire (&shared_lock);
+  f->shared = hash_insert (&shared_frames, &f->hash_elem) == NULL;
+  lock_release (&shared_lock);
+}
+
+/* Locks P's frame into memory, if it has one.
+   Upon return, p->frame will not change until P is unlocked. */
+void
+frame_lock (struct page *p) 
+{
+  /* A frame can be asynchronously removed, but never inserted. */
+  struct frame *f = p->frame;
+  if (f != NULL) 
+    {
+      lock_acquire (&f->lock);
+      if (f != p->frame)
+        {
+          lock_release (&f->lock);
+          ASSERT (p->frame == NULL); 
+        } 
+    }
+}
+
+/* Unmaps page P from frame F and unlocks F.
+   F must be locked for use by the current process.
+   Once no page is mapped to F, it is free for use by another
+   page and any data in it is lost. */
+void
+frame_free (struct frame *f, struct page *p)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  list_remove (&p->frame_elem);
+  p->frame = NULL;
+  if (list_empty (&f->pages))
+    unshare (f);
+  lock_release (&f->lock);
+}
+
+/* Unlocks frame F, allowing it to be evicted.
+   F must be locked for use by the current process. */
+void
+frame_unlock (struct frame *f) 
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  lock_release (&f->lock);
+}
@@ -0,0 +1,43 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include "devices/disk.h"
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct page;
+
+/* A physical frame that holds a user page.  A frame holding
+   read-only executable data may be mapped by several processes
+   at once; it stays in use until the last of them lets go. */
+struct frame 
+  {
+    struct lock lock;           /* Prevents simultaneous access. */
+    void *base;                 /* Kernel virtual base address. */
+    struct list pages;          /* Mapped process pages, if any. */
+
+    /* Sharing, protected by lock. */
+    bool shared;                /* In shared_frames? */
+    struct hash_elem hash_elem; /* shared_frames element. */
+    disk_sector_t sector;       /* Inode sector of the data's file. */
+    off_t offset;               /* Offset of the data in the file. */
+  };
+
+/* Kernel address of the shared zero page. */
+extern void *zero_page;
+
+void frame_init (void);
+
+struct frame *frame_alloc_and_lock (struct page *);
+struct frame *frame_find_shared_and_lock (struct page *,
+                                          disk_sector_t, off_t);
+void frame_share (struct frame *, disk_sector_t, off_t);
+void frame_lock (struct page *);
+
+void frame_free (struct frame *, struct page *);
+void frame_unlock (struct frame *);
+
+#endif /* vm/frame.h */
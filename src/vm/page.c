@@ -0,0 +1,516 @@
+#include "vm/page.h"
+#include <stdio.h>
+#include <string.h>
+#include "vm/frame.h"
+#include "vm/swap.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+#include "threads/vaddr.h"
+
+/* Maximum size of a user stack, in pages.  Stack pages are only
+   allocated as the stack grows into them. */
+size_t stack_max_pages = 256;
+
+/* Destroys a page, which must be in the current process's
+   page table.  Used as a callback for hash_destroy(). */
+static void
+destroy_page (struct hash_elem *p_, void *aux UNUSED)
+{
+  struct page *p = hash_entry (p_, struct page, hash_elem);
+  frame_lock (p);
+
+  /* Unmap the page first, so that pagedir_destroy() does not hand
+     its frame, or the zero page, back to the page allocator. */
+  pagedir_clear_page (p->thread->pagedir, p->addr);
+  if (p->frame)
+    frame_free (p->frame, p);
+  swap_free (p);
+  free (p);
+}
+
+/* Destroys the current process's page table. */
+void
+page_exit (void) 
+{
+  struct thread *t = thread_current ();
+  struct hash *h = t->pages;
+
+  if (h != NULL)
+    {
+      t->pages = NULL;
+      hash_destroy (h, destroy_page);
+      free (h);
+    }
+}
+
+/* Returns the page containing the given virtual ADDRESS,
+   or a null pointer if no such page exists.  Allocates stack
+   pages as necessary. */
+static struct page *
+page_for_addr (const void *address) 
+{
+  struct thread *t = thread_current ();
+
+  if (address < PHYS_BASE && t->pages != NULL) 
+    {
+      struct page p;
+      struct hash_elem *e;
+
+      /* Find existing page. */
+      p.addr = (void *) pg_round_down (address);
+      e = hash_find (t->pages, &p.hash_elem);
+      if (e != NULL)
+        return hash_entry (e, struct page, hash_elem);
+
+      /* Grow the stack if ADDRESS is within the stack limit and
+         no more than 32 bytes below the user stack pointer,
+         the farthest below esp that PUSHA writes. */
+      if ((uint8_t *) address >= (uint8_t *) PHYS_BASE - stack_max_pages * PGSIZE
+          && (uint8_t *) address >= (uint8_t *) t->user_esp - 32)
+        return page_allocate ((void *) address, false);
+    }
+
+  return NULL;
+}
+
+/* Locks a frame for page P and pages it in.
+   Returns true if successful, false on failure, including a file
+   too short to supply the page's data, in which case P is left
+   without a frame. */
+static bool
+do_page_in (struct page *p) 
+{
+  /* Read-only file data is never written back, so any process
+     running the same executable can map the same frame. */
+  bool sharable = p->read_only && p->file != NULL;
+  disk_sector_t sector = 0;
+
+  if (sharable) 
+    {
+      sector = inode_get_inumber (file_get_inode (p->file));
+      p->frame = frame_find_shared_and_lock (p, sector, p->file_offset);
+      if (p->frame != NULL)
+        return true;
+    }
+
+  /* Get a frame for the page. */
+  p->frame = frame_alloc_and_lock (p);
+  if (p->frame == NULL)
+    return false;
+
+  /* Copy data into the frame. */
+  if (p->sector != (disk_sector_t) -1) 
+    {
+      /* Get data from swap. */
+      swap_in (p); 
+    }
+  else if (p->file != NULL) 
+    {
+      /* Get data from file. */
+      off_t read_bytes = file_read_at (p->file, p->frame->base,
+                                        p->file_bytes, p->file_offset);
+      if (read_bytes != p->file_bytes)
+        {
+          /* The file is shorter than the page expects. */
+          frame_free (p->frame, p);
+          return false;
+        }
+      memset ((uint8_t *) p->frame->base + read_bytes, 0,
+              PGSIZE - read_bytes);
+      if (sharable)
+        frame_share (p->frame, sector, p->file_offset);
+    }
+  else 
+    {
+      /* Provide all-zero page. */
+      memset (p->frame->base, 0, PGSIZE);
+    }
+
+  return true;
+}
+
+/* Returns true if page P, which must have a locked frame, may be
+   mapped writable: it is not read-only, and it is not sharing its
+   frame copy-on-write with another process's page. */
+static bool
+may_write (struct page *p) 
+{
+  struct list *pages = &p->frame->pages;
+  return !p->read_only && list_begin (pages) == list_rbegin (pages);
+}
+
+/* Makes writable page P, which must have a locked frame, writable
+   in its process's page table.  If P shares its frame
+   copy-on-write, it first moves to a private copy of the frame,
+   which is then the one locked.
+   Returns true if successful, false on failure. */
+static bool
+make_writable (struct page *p) 
+{
+  struct frame *f = p->frame;
+  uint32_t *pd = p->thread->pagedir;
+  struct frame *copy;
+  bool dirty;
+
+  ASSERT (!p->read_only);
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  if (may_write (p)) 
+    {
+      pagedir_set_writable (pd, p->addr, true);
+      return true;
+    }
+
+  /* Holding F keeps its data in place while we copy it; the frame
+     scan skips frames its caller holds. */
+  dirty = pagedir_is_dirty (pd, p->addr);
+  list_remove (&p->frame_elem);
+  copy = frame_alloc_and_lock (p);
+  if (copy == NULL) 
+    {
+      list_push_back (&f->pages, &p->frame_elem);
+      return false;
+    }
+  memcpy (copy->base, f->base, PGSIZE);
+  p->frame = copy;
+  frame_unlock (f);
+
+  pagedir_clear_page (pd, p->addr);
+  if (!pagedir_set_page (pd, p->addr, copy->base, true))
+    return false;
+  pagedir_set_dirty (pd, p->addr, dirty);
+  return true;
+}
+
+/* Returns true if page P, which has no frame, is an anonymous
+   page that has never been written, so that it reads as zeros. */
+static bool
+is_zero (struct page *p) 
+{
+  return p->file == NULL && p->sector == (disk_sector_t) -1;
+}
+
+/* Gives page P, which has no frame, a frame of its own, locked
+   into memory, and maps it in place of the zero page, if P was
+   mapped there.
+   Returns true if successful, false on failure. */
+static bool
+map_frame (struct page *p) 
+{
+  uint32_t *pd = p->thread->pagedir;
+
+  pagedir_clear_page (pd, p->addr);
+  if (!do_page_in (p))
+    return false;
+  if (!pagedir_set_page (pd, p->addr, p->frame->base, may_write (p)))
+    {
+      frame_unlock (p->frame);
+      return false;
+    }
+  return true;
+}
+
+/* Faults in the page containing FAULT_ADDR, for writing if WRITE
+   is true.
+   Returns true if successful, false on failure. */
+bool
+page_in (void *fault_addr, bool write) 
+{
+  struct page *p;
+  bool success;
+
+  p = page_for_addr (fault_addr);
+  if (p == NULL) 
+    return false; 
+
+  frame_lock (p);
+  if (p->frame == NULL) 
+    {
+      /* Until its first write, a zero page costs no frame. */
+      if (!write && is_zero (p))
+        return pagedir_set_page (thread_current ()->pagedir, p->addr,
+                                 zero_page, false);
+      if (!do_page_in (p))
+        return false;
+    }
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+    
+  /* Install frame into page table. */
+  success = pagedir_set_page (thread_current ()->pagedir, p->addr,
+                              p->frame->base, may_write (p));
+
+  /* Release frame. */
+  frame_unlock (p->frame);
+
+  return success;
+}
+
+/* Handles a write to the present but read-only page containing
+   FAULT_ADDR, copying the page if it is shared copy-on-write or
+   giving it a frame if it is mapped to the zero page.
+   Returns true if successful, false if the page may not be
+   written. */
+bool
+page_copy_on_write (void *fault_addr) 
+{
+  struct page *p = page_for_addr (fault_addr);
+  bool success;
+
+  if (p == NULL || p->read_only)
+    return false;
+
+  frame_lock (p);
+  if (p->frame == NULL) 
+    {
+      /* Evicted meanwhile: retrying the access faults it back
+         in. */
+      if (pagedir_get_page (p->thread->pagedir, p->addr) != zero_page)
+        return true;
+
+      if (!map_frame (p))
+        return false;
+      frame_unlock (p->frame);
+      return true;
+    }
+  success = make_writable (p);
+  frame_unlock (p->frame);
+  return success;
+}
+
+/* Gives the current process, which must have an empty page
+   table, a copy of PARENT's address space.  Pages that are in
+   memory are shared copy-on-write, pages in swap are first
+   brought back in to be shared the same way, and the rest are
+   copied by description only, so no data is copied here.
+   Memory-mapped files are not inherited.  PARENT must not run
+   until this returns.
+   Returns true if successful, false on failure. */
+bool
+page_fork (struct thread *parent) 
+{
+  struct thread *t = thread_current ();
+  struct hash_iterator i;
+
+  hash_first (&i, parent->pages);
+  while (hash_next (&i)) 
+    {
+      struct page *pp = hash_entry (hash_cur (&i), struct page, hash_elem);
+      struct page *cp;
+
+      if (pp->file != NULL && !pp->private && !pp->read_only)
+        continue;
+
+      cp = page_allocate (pp->addr, pp->read_only);
+      if (cp == NULL)
+        return false;
+      cp->private = pp->private;
+      cp->file = pp->file != NULL ? t->bin_file : NULL;
+      cp->file_offset = pp->file_offset;
+      cp->file_bytes = pp->file_bytes;
+
+      frame_lock (pp);
+      if (pp->frame == NULL && pp->sector != (disk_sector_t) -1) 
+        {
+          if (!do_page_in (pp))
+            return false;
+          if (!pagedir_set_page (parent->pagedir, pp->addr,
+                                 pp->frame->base, false)) 
+            {
+              frame_unlock (pp->frame);
+              return false;
+            }
+        }
+      if (pp->frame != NULL) 
+        {
+          struct frame *f = pp->frame;
+          bool dirty = pagedir_is_dirty (parent->pagedir, pp->addr);
+
+          /* Both processes now fault on their first write. */
+          list_push_back (&f->pages, &cp->frame_elem);
+          cp->frame = f;
+          pagedir_set_writable (parent->pagedir, pp->addr, false);
+          if (!pagedir_set_page (t->pagedir, cp->addr, f->base, false)) 
+            {
+              frame_unlock (f);
+              return false;
+            }
+
+          /* The data may differ from the file it came from. */
+          pagedir_set_dirty (t->pagedir, cp->addr, dirty);
+          frame_unlock (f);
+        }
+    }
+  return true;
+}
+
+/* Evicts page P.
+   P must have a locked frame.
+   Return true if successful, false on failure. */
+bool
+page_out (struct page *p) 
+{
+  bool dirty;
+  bool ok = false;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Mark page not present in page table, forcing accesses by the
+     process to fault.  This must happen before checking the
+     dirty bit, to prevent a race with the process dirtying the
+     page. */
+  pagedir_clear_page (p->thread->pagedir, p->addr);
+
+  /* Has the frame been modified? */
+  dirty = pagedir_is_dirty (p->thread->pagedir, p->addr);
+
+  /* If the frame is not dirty (and file != NULL), we have
+     sucessfully evicted the page. */
+  if (!dirty && p->file != NULL)
+    ok = true;
+  else if (p->file == NULL || p->private)
+    ok = swap_out (p);
+  else
+    ok = file_write_at (p->file, p->frame->base, p->file_bytes,
+                        p->file_offset) == p->file_bytes;
+
+  /* Nullify the frame held by the page. */
+  if (ok)
+    p->frame = NULL;
+  return ok;
+}
+
+/* Returns true if page P's data has been accessed recently,
+   false otherwise.
+   P must have a frame locked into memory. */
+bool
+page_accessed_recently (struct page *p) 
+{
+  bool was_accessed;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  was_accessed = pagedir_is_accessed (p->thread->pagedir, p->addr);
+  if (was_accessed)
+    pagedir_set_accessed (p->thread->pagedir, p->addr, false);
+  return was_accessed;
+}
+
+/* Adds a mapping for user virtual address VADDR to the page hash
+   table.  Fails if VADDR is already mapped or if memory
+   allocation fails. */
+struct page *
+page_allocate (void *vaddr, bool read_only)
+{
+  struct thread *t = thread_current ();
+  struct page *p = malloc (sizeof *p);
+  if (p != NULL) 
+    {
+      p->addr = pg_round_down (vaddr);
+
+      p->read_only = read_only;
+      p->private = !read_only;
+
+      p->frame = NULL;
+
+      p->sector = (disk_sector_t) -1;
+
+      p->file = NULL;
+      p->file_offset = 0;
+      p->file_bytes = 0;
+
+      p->thread = thread_current ();
+
+      if (hash_insert (t->pages, &p->hash_elem) != NULL) 
+        {
+          /* Already mapped. */
+          free (p);
+          p = NULL;
+        }
+    }
+  return p;
+}
+
+/* Evicts the page containing address VADDR
+   and removes it from the page table. */
+void
+page_deallocate (void *vaddr) 
+{
+  struct page *p = page_for_addr (vaddr);
+  ASSERT (p != NULL);
+  frame_lock (p);
+  if (p->frame)
+    {
+      struct frame *f = p->frame;
+      if (p->file && !p->private) 
+        page_out (p); 
+      else
+        pagedir_clear_page (p->thread->pagedir, p->addr);
+      frame_free (f, p);
+    }
+  swap_free (p);
+  hash_delete (thread_current ()->pages, &p->hash_elem);
+  free (p);
+}
+
+/* Returns a hash value for the page that E refers to. */
+unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return ((uintptr_t) p->addr) >> PGBITS;
+}
+
+/* Returns true if page A precedes page B. */
+bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED) 
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  
+  return a->addr < b->addr;
+}
+
+/* Tries to lock the page containing ADDR into physical memory.
+   If WILL_WRITE is true, the page must be writeable;
+   otherwise it may be read-only.  A never-written page that will
+   only be read is mapped to the zero page, which needs no frame
+   and never leaves memory.
+   Returns true if successful, false on failure. */
+bool
+page_lock (const void *addr, bool will_write) 
+{
+  struct page *p = page_for_addr (addr);
+  if (p == NULL || (p->read_only && will_write))
+    return false;
+  
+  frame_lock (p);
+  if (p->frame == NULL && !will_write && is_zero (p))
+    return pagedir_set_page (p->thread->pagedir, p->addr, zero_page, false);
+  if (p->frame == NULL && !map_frame (p))
+    return false;
+
+  /* The kernel's own writes would fault on a copy-on-write
+     mapping while we hold the frame, so break the sharing now. */
+  if (will_write && !make_writable (p)) 
+    {
+      frame_unlock (p->frame);
+      return false;
+    }
+  return true;
+}
+
+/* Unlocks a page locked with page_lock(). */
+void
+page_unlock (const void *addr) 
+{
+  struct page *p = page_for_addr (addr);
+  ASSERT (p != NULL);
+  if (p->frame != NULL)
+    frame_unlock (p->frame);
+}